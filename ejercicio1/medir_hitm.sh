@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Compara el false sharing de los buffers con el layout actual (lados productor y
+# consumidor en líneas de caché separadas) contra uno compacto (-DSIN_ALINEAR).
+# Compila las dos versiones sin pausas y con más formularios, las corre con cada
+# etapa fijada a un core (-p auto) y cuenta los accesos HITM (líneas de caché
+# modificadas en otro core) con perf c2c. Si perf c2c no está disponible usa
+# perf stat con los eventos de la arquitectura (ver EVENTOS).
+#
+# Uso: ./medir_hitm.sh [formularios]     (por defecto 5000)
+
+N=${1:-5000}
+FUENTE="$(cd "$(dirname "$0")" && pwd)/tp1_ej1_streaming_fixed.c"
+DIR=$(mktemp -d)
+EVENTOS=${EVENTOS:-mem_load_l3_hit_retired.xsnp_hitm,offcore_response.demand_data_rd.l3_hit.hitm_other_core}
+
+trap 'rm -rf "$DIR"' EXIT
+
+if ! command -v perf > /dev/null; then
+    echo "No se encontró perf (paquete linux-tools)." >&2
+    exit 1
+fi
+
+# Formularios sintéticos: todos válidos, con DNIs distintos
+generar_formularios() {
+    for ((i = 1; i <= N; i++)); do
+        printf "%d,%d,Nombre,Apellido,01/01/1990,11%08d,Consulta numero %d\n" \
+               "$i" $((10000000 + i)) "$i" "$i"
+    done > "$DIR/formularios.txt"
+}
+
+compilar() {
+    local nombre=$1; shift
+    gcc -O2 -DPAUSA_CARGA=0 -DMAX_FORMULARIOS="$N" "$@" \
+        -o "$DIR/$nombre" "$FUENTE" -lrt || exit 1
+}
+
+# Imprime los HITM de una corrida del binario $1
+medir() {
+    local bin=$1
+    cd "$DIR" || exit 1
+    if perf c2c record -o "$DIR/$bin.data" -- "./$bin" -p auto > /dev/null 2>&1; then
+        perf c2c report -i "$DIR/$bin.data" --stats 2>/dev/null |
+            grep -E "Load (Local|Remote) HITM|Total records"
+    else
+        perf stat -x, -e "$EVENTOS" -- "./$bin" -p auto 2>&1 > /dev/null |
+            awk -F, '{ printf "%-70s %s\n", $3, $1 }'
+    fi
+    cd - > /dev/null || exit 1
+}
+
+generar_formularios
+compilar alineado
+compilar compacto -DSIN_ALINEAR
+
+echo "============== Layout alineado (actual) =============="
+medir alineado
+echo
+echo "============== Layout compacto (-DSIN_ALINEAR) =============="
+medir compacto
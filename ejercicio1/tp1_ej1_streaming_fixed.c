@@ -2,27 +2,75 @@
  * tp1_ej1_streaming_fixed.c
  *
  * Versión final: pipeline concurrente con manejo de Ctrl+C (SIGINT),
- * buffers acotados de tamaño 3 entre cada etapa, y lectura de un lote
- * más grande desde formularios.txt.
+ * buffers acotados entre cada etapa (capacidad configurable por buffer,
+ * con modo adaptativo opcional), y lectura de un lote más grande desde
+ * formularios.txt.
  *
  * Compilar en Ubuntu (o cualquier Linux con GCC):
  *   gcc -o tp1_ej1_streaming_fixed tp1_ej1_streaming_fixed.c -lrt
  *
  * Ejecutar:
- *   ./tp1_ej1_streaming_fixed
+ *   ./tp1_ej1_streaming_fixed [-c CV,VE,EC] [-a] [-m MAX]
+ *                             [-p auto|C0,C1,C2,C3[,C4]] [-d first|last|flag]
+ *
+ *   -c CV,VE,EC  capacidad inicial de cada buffer (por defecto 3,3,3).
+ *   -a           modo adaptativo: si el productor de un buffer se bloquea
+ *                repetidamente por falta de espacio mientras su consumidor
+ *                también queda ocioso, se duplica la capacidad del buffer.
+ *   -m MAX       tope de capacidad para el modo adaptativo (por defecto y
+ *                como máximo BUF_MAX).
+ *
+ *   -p auto      fija cada etapa a un core: las etapas adyacentes se ubican
+ *                en hermanos SMT o en cores que comparten L3 (según
+ *                /sys/devices/system/cpu), y la memoria de cada buffer se
+ *                liga al nodo NUMA del core de su consumidor.
+ *   -p C0,C1,C2,C3[,C4]  igual que auto pero con los cores indicados para
+ *                cargar, validar, encriptar y clasificar; C4 (opcional, con
+ *                -d) es el de deduplicar. Sin C4 lo elige la planificación.
+ *   -d first|last|flag
+ *                agrega una etapa "deduplicar" entre validar y encriptar
+ *                que detecta DNIs repetidos con un índice hash en memoria
+ *                compartida: first descarta los repetidos (se queda con el
+ *                primero), last deja sólo el último de cada DNI en los
+ *                resultados y flag los deja pasar marcados como duplicados.
+ *                Con last no se ahorra trabajo: al pasar un formulario no se
+ *                sabe si vendrá otro con su DNI, así que todos se encriptan y
+ *                clasifican y los reemplazados se filtran al mostrar.
+ *
+ *   Los formularios inválidos no siguen a encriptar/clasificar: validar los
+ *   aparta con una máscara de los controles que fallaron y al terminar se
+ *   escriben en rechazados.txt, en el mismo formato CSV de entrada (cada
+ *   uno precedido por un comentario "# id=N motivos=0xMM (...)"), para
+ *   poder corregirlos y volver a procesarlos.
+ *
+ *   Al terminar (o con Ctrl+C) se imprime la telemetría de cada buffer:
+ *   capacidad, ocupación media/máxima, bloqueos del productor y esperas
+ *   del consumidor.
+ *
+ *   Cada buffer tiene un único productor y un único consumidor, así que
+ *   no usa mutex: el lado productor y el consumidor viven en líneas de
+ *   caché distintas y cada uno guarda una copia local del índice del
+ *   otro. medir_hitm.sh compila este layout y uno compacto (-DSIN_ALINEAR),
+ *   los corre con miles de formularios y sin pausas bajo perf c2c (o
+ *   perf stat si no hay c2c) y compara los accesos HITM de cada uno.
  *
  * Durante la ejecución:
  *   - En otra terminal podés usar `ps aux | grep tp1_ej1_streaming_fixed`
- *     para ver los procesos (padre + 4 hijos).
+ *     para ver los procesos (padre + 4 hijos, o 5 con -d).
  *   - Si presionás Ctrl+C, el programa imprimirá los resultados procesados
  *     hasta ese momento y liberará los recursos IPC antes de salir.
  */
 
+#define _GNU_SOURCE         /* sched_setaffinity / CPU_SET */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/sem.h>
@@ -30,22 +78,67 @@
 #include <sys/wait.h>
 #include <errno.h>
 
+/* MAX_FORMULARIOS, PAUSA_CARGA y SIN_ALINEAR se pueden redefinir al
+   compilar (-D...); medir_hitm.sh los usa para comparar layouts */
+#ifndef MAX_FORMULARIOS
 #define MAX_FORMULARIOS 100
-#define BUF_SIZE 3
+#endif
+#ifndef PAUSA_CARGA
+#define PAUSA_CARGA 6       /* segundos entre formularios cargados */
+#endif
+#define BUF_SIZE 3          /* capacidad inicial por defecto de cada buffer */
+#define BUF_MAX  64         /* tamaño físico del anillo (capacidad máxima)  */
+#define UMBRAL_BLOQUEOS 2   /* bloqueos del productor antes de agrandar      */
+#define CACHE_LINE 64
+#ifdef SIN_ALINEAR          /* layout compacto, sólo para comparar el false sharing */
+#define ALINEADO
+#else
+#define ALINEADO __attribute__((aligned(CACHE_LINE)))
+#endif
 #define PATH_FORMULARIOS "formularios.txt"
+#define PATH_RECHAZADOS  "rechazados.txt"
+#define NUM_ETAPAS 5
+#define DEDUP_BITS  8
+#define DEDUP_SLOTS (1 << DEDUP_BITS)   /* índice de DNIs: > 2 * MAX_FORMULARIOS */
+#define PATH_CPU "/sys/devices/system/cpu"
 
-/* Índices de semáforos (9 en total, 3 por cada buffer) */
+/* Índices de semáforos (6 en total, 2 por cada buffer) */
 #define SEM_EMPTY_CV 0   /* espacios libres en buf_cv  (cargar → validar) */
 #define SEM_FULL_CV  1   /* elementos disponibles en buf_cv */
-#define SEM_MUTEX_CV 2   /* mutex para buf_cv                */
 
-#define SEM_EMPTY_VE 3   /* espacios libres en buf_ve (validar → encriptar) */
-#define SEM_FULL_VE  4   /* elementos disponibles en buf_ve */
-#define SEM_MUTEX_VE 5   /* mutex para buf_ve               */
+#define SEM_EMPTY_VE 2   /* espacios libres en buf_ve (validar → encriptar) */
+#define SEM_FULL_VE  3   /* elementos disponibles en buf_ve */
+
+#define SEM_EMPTY_EC 4   /* espacios libres en buf_ec (encriptar → clasificar) */
+#define SEM_FULL_EC  5   /* elementos disponibles en buf_ec */
+
+#define SEM_EMPTY_VD 6   /* espacios libres en buf_vd (validar → deduplicar) */
+#define SEM_FULL_VD  7   /* elementos disponibles en buf_vd */
 
-#define SEM_EMPTY_EC 6   /* espacios libres en buf_ec (encriptar → clasificar) */
-#define SEM_FULL_EC  7   /* elementos disponibles en buf_ec */
-#define SEM_MUTEX_EC 8   /* mutex para buf_ec               */
+#define NUM_SEMS 8
+
+/* Etapas (índices de cpus_etapa) */
+#define ETAPA_CARGAR     0
+#define ETAPA_VALIDAR    1
+#define ETAPA_DEDUP      2
+#define ETAPA_ENCRIPTAR  3
+#define ETAPA_CLASIFICAR 4
+
+/* Políticas de la etapa deduplicar */
+#define DEDUP_NO      0   /* sin etapa de deduplicación */
+#define DEDUP_PRIMERO 1   /* se queda con el primero, descarta los repetidos */
+#define DEDUP_ULTIMO  2   /* en los resultados queda sólo el último de cada DNI */
+#define DEDUP_MARCAR  3   /* deja pasar todos, marcando los repetidos */
+
+/* Motivos de rechazo: máscara de validaciones que fallaron (mismos bits que
+   en ejercicio3, así un "motivos=0x.." de rechazados.txt significa lo mismo) */
+#define MOTIVO_ID           0x01
+#define MOTIVO_DNI          0x02
+#define MOTIVO_NOMBRE       0x04
+#define MOTIVO_APELLIDO     0x08
+#define MOTIVO_FECHA        0x10
+#define MOTIVO_TELEFONO     0x20
+#define MOTIVO_DESCRIPCION  0x40
 
 /* Clave IPC para ftok */
 #define FTOK_PATH "/tmp"
@@ -60,38 +153,119 @@ typedef struct {
     char nroTelefono[20];
     char tipoForm[20];          /* Se completará en “clasificar” */
     char descripcion[200];
+    unsigned int motivos;       /* MOTIVO_* que fallaron en “validar” (0 = válido) */
+    int duplicado;              /* 1 si “deduplicar” ya había visto su DNI */
+    int ranura_dni;             /* entrada del índice de DNIs (-1: no se registró) */
 } Formulario;
 
-/* Estructura en memoria compartida */
+/*
+ * Buffer acotado entre dos etapas. El anillo físico tiene BUF_MAX lugares,
+ * pero la capacidad efectiva la fija el semáforo "empty": arranca en
+ * 'capacidad' y el modo adaptativo la agranda sumándole lugares libres.
+ * Como los índices recorren siempre BUF_MAX posiciones, agrandar no
+ * requiere mover los formularios que ya están en el anillo.
+ *
+ * Hay un solo productor y un solo consumidor por buffer: los semáforos
+ * empty/full alcanzan para sincronizarlos (semop hace de barrera), así que
+ * no hace falta mutex. Cada lado escribe sólo en su propia línea de caché;
+ * 'in' y 'out' son contadores crecientes y cada lado lee el índice del
+ * otro únicamente cuando su copia local indica lleno/vacío.
+ */
 typedef struct {
-    /* Buffer CV: cargar → validar */
-    Formulario buf_cv[BUF_SIZE];
-    int in_cv, out_cv;
-
-    /* Buffer VE: validar → encriptar */
-    Formulario buf_ve[BUF_SIZE];
-    int in_ve, out_ve;
+    /* Configuración: se escribe sólo al inicializar */
+    struct {
+        char nombre[4];         /* "CV", "VE", "EC" o "VD" (para la telemetría) */
+        int sem_empty, sem_full;
+        int capacidad_inicial;
+        int capacidad_max;      /* tope para el modo adaptativo */
+    } ALINEADO;
+
+    /* Lado productor */
+    struct {
+        unsigned long in;
+        unsigned long out_cache;    /* copia de 'out' del consumidor */
+        int  capacidad;             /* capacidad efectiva actual */
+        int  ocupacion_max;
+        long ocupacion_acum;        /* suma de la ocupación tras cada producción */
+        long producidos;
+        long bloqueos_productor;    /* veces que el productor encontró el buffer lleno */
+        int  bloqueos_seguidos;     /* bloqueos desde el último crecimiento */
+        int  crecimientos;
+        long esperas_al_crecer;     /* esperas_consumidor en el último crecimiento */
+    } ALINEADO;
+
+    /* Lado consumidor */
+    struct {
+        unsigned long out;
+        unsigned long in_cache;     /* copia de 'in' del productor */
+        long esperas_consumidor;    /* veces que el consumidor encontró el buffer vacío */
+    } ALINEADO;
+
+    Formulario buf[BUF_MAX] ALINEADO;
+} Cola;
+
+/* Entrada del índice de DNIs de la etapa “deduplicar” */
+typedef struct {
+    long dni;
+    int ultimo_id;              /* id del último formulario visto con este DNI */
+    int veces;
+} EntradaDni;
 
-    /* Buffer EC: encriptar → clasificar */
-    Formulario buf_ec[BUF_SIZE];
-    int in_ec, out_ec;
+/* Estructura en memoria compartida */
+typedef struct {
+    Cola cv;    /* Buffer CV: cargar → validar */
+    Cola ve;    /* Buffer VE: validar (o deduplicar con -d) → encriptar */
+    Cola ec;    /* Buffer EC: encriptar → clasificar */
+    Cola vd;    /* Buffer VD: validar → deduplicar (sólo con -d) */
 
     /* Resultados finales (almacén de formularios ya clasificados) */
+    int countResultados ALINEADO;
     Formulario resultados[MAX_FORMULARIOS];
-    int countResultados;
+
+    /* Formularios rechazados por “validar” (sólo los escribe esa etapa) */
+    int countRechazados ALINEADO;
+    Formulario rechazados[MAX_FORMULARIOS];
+
+    /* Índice de DNIs vistos (direccionamiento abierto, dni = 0 → libre) */
+    EntradaDni dnis[DEDUP_SLOTS] ALINEADO;
+    int countDuplicados;
 } DatosCompartidos;
 
 /* Variables globales IPC */
 int shmid = -1;
 int semid = -1;
 DatosCompartidos *datos = NULL;
+pid_t pid_padre;
+
+/* Configuración de los buffers (se fija en main antes de crear los hijos) */
+int capacidades[3] = { BUF_SIZE, BUF_SIZE, BUF_SIZE };
+int capacidad_max  = BUF_MAX;
+int modo_adaptativo = 0;
+
+/* Core asignado a cada etapa (-1 = sin fijar, lo decide el scheduler) */
+int cpus_etapa[NUM_ETAPAS] = { -1, -1, -1, -1, -1 };
+
+/* Política de la etapa deduplicar (DEDUP_NO = etapa desactivada) */
+int politica_dedup = DEDUP_NO;
 
 /* Prototipos */
 struct sembuf P(int sem);
 struct sembuf V(int sem);
+void inicializar_cola(Cola *c, const char *nombre, int sem_base, int capacidad);
+void producir(Cola *c, const Formulario *f);
+Formulario consumir(Cola *c);
+void imprimir_telemetria();
+void guardar_rechazados();
+void imprimir_resultados(const char *titulo);
+EntradaDni *registrar_dni(long dni, int id, int *repetido);
+void planificar_cpus(int cpus[], int n);
+int  cpu_valida(int cpu);
+void fijar_cpu(int cpu);
+void ubicar_cola(Cola *c, int cpu_consumidor);
 void invertir_cadena(char *s);
 void cargar_formularios();
 void validar_formularios();
+void deduplicar_formularios();
 void encriptar_formularios();
 void clasificar_formularios();
 void quitar_ipc();
@@ -113,6 +287,362 @@ struct sembuf V(int sem) {
     return op;
 }
 
+/* Prepara una cola vacía que usa los semáforos sem_base (empty) y sem_base+1 (full) */
+void inicializar_cola(Cola *c, const char *nombre, int sem_base, int capacidad) {
+    memset(c, 0, sizeof(*c));
+    strncpy(c->nombre, nombre, sizeof(c->nombre)-1);
+    c->sem_empty = sem_base;
+    c->sem_full  = sem_base + 1;
+    c->capacidad = c->capacidad_inicial = capacidad;
+    c->capacidad_max = capacidad_max < capacidad ? capacidad : capacidad_max;
+}
+
+/*
+ * Agranda la cola si el productor se bloqueó al menos UMBRAL_BLOQUEOS veces
+ * y el consumidor estuvo ocioso desde el último crecimiento. Si el
+ * consumidor nunca espera es el cuello de botella y más espacio no ayuda;
+ * si ambos se esperan alternadamente, un buffer más grande absorbe las
+ * ráfagas. Sólo la llama el productor.
+ */
+static void agrandar_cola(Cola *c) {
+    if (c->bloqueos_seguidos < UMBRAL_BLOQUEOS) return;
+    long esperas = __atomic_load_n(&c->esperas_consumidor, __ATOMIC_RELAXED);
+    if (esperas == c->esperas_al_crecer) return;
+    if (c->capacidad >= c->capacidad_max) return;
+
+    int nueva = c->capacidad * 2;
+    if (nueva > c->capacidad_max) nueva = c->capacidad_max;
+
+    /* Sumar los lugares nuevos al semáforo "empty" */
+    struct sembuf op = V(c->sem_empty);
+    op.sem_op = nueva - c->capacidad;
+    semop(semid, &op, 1);
+
+    printf(">> [COLA %s] Capacidad %d → %d (productor bloqueado %d veces).\n",
+           c->nombre, c->capacidad, nueva, c->bloqueos_seguidos);
+    c->capacidad = nueva;
+    c->crecimientos++;
+    c->bloqueos_seguidos = 0;
+    c->esperas_al_crecer = esperas;
+}
+
+/* Produce un formulario en la cola (bloquea si está llena) */
+void producir(Cola *c, const Formulario *f) {
+    struct sembuf op;
+
+    /* Sólo se mira el índice del consumidor si la copia local dice "lleno" */
+    if (c->in - c->out_cache >= (unsigned long)c->capacidad) {
+        c->out_cache = __atomic_load_n(&c->out, __ATOMIC_ACQUIRE);
+        if (c->in - c->out_cache >= (unsigned long)c->capacidad) {
+            c->bloqueos_productor++;
+            c->bloqueos_seguidos++;
+            if (modo_adaptativo)
+                agrandar_cola(c);
+        }
+    }
+
+    op = P(c->sem_empty);
+    semop(semid, &op, 1);
+
+    c->buf[c->in % BUF_MAX] = *f;
+    __atomic_store_n(&c->in, c->in + 1, __ATOMIC_RELEASE);
+
+    /* Ocupación tras producir: se lee 'out' (relajado, es sólo una muestra);
+       'out_cache' no sirve acá porque sólo se refresca cuando parece lleno */
+    int ocupacion = (int)(c->in - __atomic_load_n(&c->out, __ATOMIC_RELAXED));
+    c->producidos++;
+    c->ocupacion_acum += ocupacion;
+    if (ocupacion > c->ocupacion_max)
+        c->ocupacion_max = ocupacion;
+
+    op = V(c->sem_full);
+    semop(semid, &op, 1);
+}
+
+/* Consume un formulario de la cola (bloquea si está vacía) */
+Formulario consumir(Cola *c) {
+    Formulario f;
+    struct sembuf op;
+
+    /* Sólo se mira el índice del productor si la copia local dice "vacío"
+       (o quedó atrás: tras esperar en sem_full se consume sin recargarla) */
+    if (c->out >= c->in_cache) {
+        c->in_cache = __atomic_load_n(&c->in, __ATOMIC_ACQUIRE);
+        if (c->out == c->in_cache)
+            __atomic_store_n(&c->esperas_consumidor, c->esperas_consumidor + 1,
+                             __ATOMIC_RELAXED);
+    }
+
+    op = P(c->sem_full);
+    semop(semid, &op, 1);
+
+    f = c->buf[c->out % BUF_MAX];
+    __atomic_store_n(&c->out, c->out + 1, __ATOMIC_RELEASE);
+
+    op = V(c->sem_empty);
+    semop(semid, &op, 1);
+
+    return f;
+}
+
+/* Imprime capacidad, ocupación y contadores de bloqueo de cada buffer */
+void imprimir_telemetria() {
+    Cola *colas[4];
+    int n = 0;
+    colas[n++] = &datos->cv;
+    if (politica_dedup != DEDUP_NO)
+        colas[n++] = &datos->vd;
+    colas[n++] = &datos->ve;
+    colas[n++] = &datos->ec;
+
+    printf("\n--- Telemetría de buffers ---\n");
+    for (int i = 0; i < n; i++) {
+        Cola *c = colas[i];
+        double media = c->producidos > 0
+                     ? (double)c->ocupacion_acum / (double)c->producidos : 0.0;
+        printf("Buffer %-2s | capacidad %2d (inicial %2d, máx %2d, crecimientos %d)"
+               " | producidos %3ld | ocupación media %5.2f, máx %2d"
+               " | bloqueos productor %3ld | esperas consumidor %3ld\n",
+               c->nombre, c->capacidad, c->capacidad_inicial, c->capacidad_max,
+               c->crecimientos, c->producidos, media, c->ocupacion_max,
+               c->bloqueos_productor, c->esperas_consumidor);
+    }
+}
+
+/*
+ * Registra un DNI en el índice de memoria compartida y devuelve su entrada
+ * (NULL si el índice está lleno). *repetido queda en 1 si ya estaba.
+ * Las entradas se reclaman con compare-and-swap sobre el DNI, así que el
+ * índice no necesita semáforo aunque haya más de un deduplicador.
+ */
+EntradaDni *registrar_dni(long dni, int id, int *repetido) {
+    unsigned long h = ((unsigned long)dni * 0x9E3779B97F4A7C15UL) >> (64 - DEDUP_BITS);
+
+    for (int i = 0; i < DEDUP_SLOTS; i++) {
+        EntradaDni *e = &datos->dnis[(h + i) & (DEDUP_SLOTS - 1)];
+        long esperado = 0;
+        if (__atomic_compare_exchange_n(&e->dni, &esperado, dni, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+         || esperado == dni) {
+            *repetido = __atomic_fetch_add(&e->veces, 1, __ATOMIC_ACQ_REL) > 0;
+            __atomic_store_n(&e->ultimo_id, id, __ATOMIC_RELEASE);
+            return e;
+        }
+    }
+    *repetido = 0;
+    return NULL;
+}
+
+/* Con política DEDUP_ULTIMO, un resultado vale sólo si es el último de su DNI */
+static int es_vigente(const Formulario *f) {
+    if (politica_dedup != DEDUP_ULTIMO || f->ranura_dni < 0)
+        return 1;
+    return datos->dnis[f->ranura_dni].ultimo_id == f->id;
+}
+
+/* Imprime los resultados clasificados (filtrando los reemplazados con -d last) */
+void imprimir_resultados(const char *titulo) {
+    int vigentes = 0;
+    for (int i = 0; i < datos->countResultados; i++)
+        vigentes += es_vigente(&datos->resultados[i]);
+
+    printf("\n--- %s (%d formularios) ---\n", titulo, vigentes);
+    for (int i = 0; i < datos->countResultados; i++) {
+        Formulario *f = &datos->resultados[i];
+        if (!es_vigente(f))
+            continue;
+        printf("ID:%3d | DNI(encriptado):%8ld | Nombre: %-10s %-10s | FechaNac:%10s | Tel(encriptado):%-10s | Tipo:%-8s | Desc:%s%s\n",
+               f->id, f->dni,
+               f->nombre, f->apellido,
+               f->fechaNac,
+               f->nroTelefono,
+               f->tipoForm,
+               f->descripcion,
+               f->duplicado ? " [DUPLICADO]" : "");
+    }
+    if (politica_dedup != DEDUP_NO)
+        printf("DNIs duplicados detectados: %d\n", datos->countDuplicados);
+}
+
+/* Escribe "dni,nombre,..." con los nombres de los motivos de la máscara */
+static void describir_motivos(unsigned int motivos, char *buf, size_t n) {
+    static const struct { unsigned int bit; const char *nombre; } tabla[] = {
+        { MOTIVO_ID, "id" },
+        { MOTIVO_DNI, "dni" },           { MOTIVO_NOMBRE, "nombre" },
+        { MOTIVO_APELLIDO, "apellido" }, { MOTIVO_FECHA, "fechaNac" },
+        { MOTIVO_TELEFONO, "telefono" }, { MOTIVO_DESCRIPCION, "descripcion" },
+    };
+    buf[0] = '\0';
+    for (size_t i = 0; i < sizeof(tabla) / sizeof(tabla[0]); i++) {
+        if (motivos & tabla[i].bit) {
+            size_t len = strlen(buf);
+            snprintf(buf + len, n - len, "%s%s", len ? "," : "", tabla[i].nombre);
+        }
+    }
+}
+
+/* Vuelca los formularios rechazados a PATH_RECHAZADOS (cola de "dead letters") */
+void guardar_rechazados() {
+    FILE *fp = fopen(PATH_RECHAZADOS, "w");
+    if (!fp) {
+        perror("fopen " PATH_RECHAZADOS);
+        return;
+    }
+    for (int i = 0; i < datos->countRechazados; i++) {
+        Formulario *f = &datos->rechazados[i];
+        char motivos[128];
+        describir_motivos(f->motivos, motivos, sizeof(motivos));
+        fprintf(fp, "# id=%d motivos=0x%02x (%s)\n", f->id, f->motivos, motivos);
+        fprintf(fp, "%d,%ld,%s,%s,%s,%s,%s\n", f->id, f->dni, f->nombre, f->apellido,
+                f->fechaNac, f->nroTelefono, f->descripcion);
+    }
+    fclose(fp);
+    printf("\n--- %d formularios rechazados guardados en %s ---\n",
+           datos->countRechazados, PATH_RECHAZADOS);
+}
+
+/* Lee una lista de cores de sysfs con formato "0-3,8,10-11" */
+static int leer_lista_cpus(const char *ruta, cpu_set_t *set) {
+    char linea[256];
+    FILE *fp = fopen(ruta, "r");
+    CPU_ZERO(set);
+    if (!fp) return -1;
+    if (!fgets(linea, sizeof(linea), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    for (char *tok = strtok(linea, ",\n"); tok; tok = strtok(NULL, ",\n")) {
+        int desde, hasta;
+        int n = sscanf(tok, "%d-%d", &desde, &hasta);
+        if (n < 1) continue;
+        if (n == 1) hasta = desde;
+        for (int c = desde; c <= hasta && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+    }
+    return 0;
+}
+
+/* Busca un core permitido y libre dentro del conjunto de topología 'archivo' de 'cpu' */
+static int vecino_libre(int cpu, const char *archivo,
+                        const cpu_set_t *permitidos, const cpu_set_t *usados) {
+    char ruta[128];
+    cpu_set_t set;
+    snprintf(ruta, sizeof(ruta), PATH_CPU "/cpu%d/%s", cpu, archivo);
+    if (leer_lista_cpus(ruta, &set) < 0) return -1;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &set) && CPU_ISSET(c, permitidos) && !CPU_ISSET(c, usados))
+            return c;
+    }
+    return -1;
+}
+
+/* Devuelve el nodo NUMA de un core (-1 si el sistema no expone nodos) */
+static int nodo_de_cpu(int cpu) {
+    char ruta[128];
+    snprintf(ruta, sizeof(ruta), PATH_CPU "/cpu%d", cpu);
+    DIR *dir = opendir(ruta);
+    if (!dir) return -1;
+
+    int nodo = -1;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        if (strncmp(e->d_name, "node", 4) == 0 && sscanf(e->d_name + 4, "%d", &nodo) == 1)
+            break;
+    }
+    closedir(dir);
+    return nodo;
+}
+
+/*
+ * Completa las posiciones en -1 de cpus[] ubicando cada etapa cerca de la
+ * anterior: primero un hermano SMT, luego un core que comparta L3, luego
+ * uno del mismo nodo NUMA y, si no queda ninguno, cualquier core libre.
+ * Si hay menos cores que etapas, se reutilizan en orden.
+ */
+void planificar_cpus(int cpus[], int n) {
+    cpu_set_t permitidos, usados;
+    CPU_ZERO(&usados);
+    if (sched_getaffinity(0, sizeof(permitidos), &permitidos) < 0) {
+        perror("sched_getaffinity");
+        return;
+    }
+    int total = CPU_COUNT(&permitidos);
+
+    for (int i = 0; i < n; i++) {
+        if (cpus[i] >= 0) {
+            CPU_SET(cpus[i], &usados);
+            continue;
+        }
+        if (CPU_COUNT(&usados) >= total)
+            CPU_ZERO(&usados);
+
+        int c = -1;
+        if (i > 0) {
+            c = vecino_libre(cpus[i-1], "topology/thread_siblings_list", &permitidos, &usados);
+            if (c < 0) c = vecino_libre(cpus[i-1], "cache/index3/shared_cpu_list", &permitidos, &usados);
+            if (c < 0) {
+                int nodo = nodo_de_cpu(cpus[i-1]);
+                char archivo[64];
+                snprintf(archivo, sizeof(archivo), "node%d/cpulist", nodo);
+                if (nodo >= 0) c = vecino_libre(cpus[i-1], archivo, &permitidos, &usados);
+            }
+        }
+        for (int k = 0; c < 0 && k < CPU_SETSIZE; k++) {
+            if (CPU_ISSET(k, &permitidos) && !CPU_ISSET(k, &usados))
+                c = k;
+        }
+        cpus[i] = c;
+        CPU_SET(c, &usados);
+    }
+}
+
+/*
+ * Un core pedido con -p sirve si el proceso puede correr en él (está en
+ * línea y en su afinidad). Si no hay forma de saberlo se acepta y, si no
+ * existe, lo informará sched_setaffinity en el hijo.
+ */
+int cpu_valida(int cpu) {
+    cpu_set_t permitidos;
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return 0;
+    if (sched_getaffinity(0, sizeof(permitidos), &permitidos) < 0
+     && leer_lista_cpus(PATH_CPU "/online", &permitidos) < 0)
+        return 1;
+    return CPU_ISSET(cpu, &permitidos);
+}
+
+/* Fija el proceso actual a un core */
+void fijar_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        perror("sched_setaffinity");
+}
+
+/*
+ * Liga las páginas del anillo de la cola al nodo NUMA del core que la
+ * consume, que es quien más la lee. Sólo se ligan las páginas completas
+ * que caen dentro de la cola; si el kernel no soporta NUMA no se hace nada.
+ * Hay que llamarla antes de inicializar_cola(): la política se aplica
+ * cuando cada página se toca por primera vez.
+ */
+void ubicar_cola(Cola *c, int cpu_consumidor) {
+    int nodo = nodo_de_cpu(cpu_consumidor);
+    if (nodo < 0 || nodo >= (int)(8 * sizeof(unsigned long))) return;
+
+    long pagina = sysconf(_SC_PAGESIZE);
+    unsigned long inicio = ((unsigned long)c + pagina - 1) & ~(pagina - 1);
+    unsigned long fin    = ((unsigned long)c + sizeof(*c)) & ~(pagina - 1);
+    if (fin <= inicio) return;
+
+    unsigned long mascara = 1UL << nodo;
+    if (syscall(SYS_mbind, inicio, fin - inicio, MPOL_PREFERRED,
+                &mascara, 8 * sizeof(mascara), 0) < 0 && errno != ENOSYS)
+        perror("mbind");
+}
+
 /* Invierte una cadena in-place (usado en “encriptar”) */
 void invertir_cadena(char *s) {
     size_t len = strlen(s);
@@ -129,18 +659,10 @@ void manejar_sigint(int sig) {
     printf("\n\n[!] Interrupción recibida (Ctrl+C)\n");
 
     if (datos) {
-        printf("\n--- Resultados parciales (%d formularios) ---\n",
-               datos->countResultados);
-        for (int i = 0; i < datos->countResultados; i++) {
-            Formulario *f = &datos->resultados[i];
-            printf("ID:%3d | DNI(encriptado):%8ld | Nombre: %-10s %-10s | FechaNac:%10s | Tel(encriptado):%-10s | Tipo:%-8s | Desc:%s\n",
-                   f->id, f->dni,
-                   f->nombre, f->apellido,
-                   f->fechaNac,
-                   f->nroTelefono,
-                   f->tipoForm,
-                   f->descripcion);
-        }
+        imprimir_resultados("Resultados parciales");
+        imprimir_telemetria();
+        if (getpid() == pid_padre)
+            guardar_rechazados();
     }
 
     quitar_ipc();
@@ -148,8 +670,123 @@ void manejar_sigint(int sig) {
     exit(EXIT_SUCCESS);
 }
 
-int main() {
+static void uso(const char *prog) {
+    fprintf(stderr, "Uso: %s [-c CV,VE,EC] [-a] [-m MAX] [-p auto|C0,C1,C2,C3[,C4]]"
+                    " [-d first|last|flag]\n", prog);
+    fprintf(stderr, "  -c CV,VE,EC  capacidad inicial de cada buffer (1..%d, por defecto %d;\n"
+                    "               el buffer validar → deduplicar usa la de VE)\n",
+            BUF_MAX, BUF_SIZE);
+    fprintf(stderr, "  -a           modo adaptativo (agranda buffers con contrapresión)\n");
+    fprintf(stderr, "  -m MAX       capacidad máxima en modo adaptativo (1..%d)\n", BUF_MAX);
+    fprintf(stderr, "  -p auto      fija cada etapa a un core (vecinas en SMT/L3)\n");
+    fprintf(stderr, "  -p C0,..,C3  fija cargar, validar, encriptar y clasificar a esos cores\n");
+    fprintf(stderr, "  -p C0,..,C4  ídem y C4 para deduplicar (con -d)\n");
+    fprintf(stderr, "  -d POLÍTICA  etapa de DNIs duplicados: first (descarta repetidos),\n"
+                    "               last (queda el último) o flag (los marca)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int fijar_etapas = 0;
+    int cpus[NUM_ETAPAS];
+    int n_cpus = 0;
+    while ((opt = getopt(argc, argv, "c:am:p:d:")) != -1) {
+        switch (opt) {
+            case 'c':
+                if (sscanf(optarg, "%d,%d,%d",
+                           &capacidades[0], &capacidades[1], &capacidades[2]) != 3) {
+                    uso(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'a':
+                modo_adaptativo = 1;
+                break;
+            case 'm':
+                capacidad_max = atoi(optarg);
+                break;
+            case 'p':
+                fijar_etapas = 1;
+                if (strcmp(optarg, "auto") != 0) {
+                    n_cpus = sscanf(optarg, "%d,%d,%d,%d,%d",
+                                    &cpus[0], &cpus[1], &cpus[2], &cpus[3], &cpus[4]);
+                    if (n_cpus < NUM_ETAPAS - 1) {
+                        uso(argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    for (int i = 0; i < n_cpus; i++) {
+                        if (!cpu_valida(cpus[i])) {
+                            fprintf(stderr, "Core inválido: %d (no está en línea o no está"
+                                            " permitido)\n", cpus[i]);
+                            uso(argv[0]);
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                }
+                break;
+            case 'd':
+                if      (strcmp(optarg, "first") == 0) politica_dedup = DEDUP_PRIMERO;
+                else if (strcmp(optarg, "last")  == 0) politica_dedup = DEDUP_ULTIMO;
+                else if (strcmp(optarg, "flag")  == 0) politica_dedup = DEDUP_MARCAR;
+                else {
+                    uso(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                uso(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        if (capacidades[i] < 1 || capacidades[i] > BUF_MAX) {
+            fprintf(stderr, "Capacidad inválida: %d (debe estar entre 1 y %d)\n",
+                    capacidades[i], BUF_MAX);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (capacidad_max < 1 || capacidad_max > BUF_MAX) {
+        fprintf(stderr, "Capacidad máxima inválida: %d (debe estar entre 1 y %d)\n",
+                capacidad_max, BUF_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Etapas activas, en orden de pipeline */
+    int etapas[NUM_ETAPAS];
+    int n_etapas = 0;
+    for (int e = 0; e < NUM_ETAPAS; e++) {
+        if (e != ETAPA_DEDUP || politica_dedup != DEDUP_NO)
+            etapas[n_etapas++] = e;
+    }
+
+    if (fijar_etapas) {
+        /* C0..C3 siempre son las etapas fijas; sin C4, deduplicar queda a
+           cargo de la planificación */
+        if (n_cpus >= NUM_ETAPAS - 1) {
+            cpus_etapa[ETAPA_CARGAR]     = cpus[0];
+            cpus_etapa[ETAPA_VALIDAR]    = cpus[1];
+            cpus_etapa[ETAPA_ENCRIPTAR]  = cpus[2];
+            cpus_etapa[ETAPA_CLASIFICAR] = cpus[3];
+        }
+        if (n_cpus == NUM_ETAPAS)
+            cpus_etapa[ETAPA_DEDUP] = cpus[4];
+
+        int plan[NUM_ETAPAS];
+        for (int i = 0; i < n_etapas; i++) plan[i] = cpus_etapa[etapas[i]];
+        planificar_cpus(plan, n_etapas);
+        for (int i = 0; i < n_etapas; i++) cpus_etapa[etapas[i]] = plan[i];
+
+        printf(">> Etapas fijadas a cores: cargar=%d validar=%d",
+               cpus_etapa[ETAPA_CARGAR], cpus_etapa[ETAPA_VALIDAR]);
+        if (politica_dedup != DEDUP_NO)
+            printf(" deduplicar=%d", cpus_etapa[ETAPA_DEDUP]);
+        printf(" encriptar=%d clasificar=%d\n",
+               cpus_etapa[ETAPA_ENCRIPTAR], cpus_etapa[ETAPA_CLASIFICAR]);
+        fflush(stdout);  /* que los hijos no hereden el mensaje en el buffer */
+    }
+
     /* Instalar manejador para Ctrl+C */
+    pid_padre = getpid();
     signal(SIGINT, manejar_sigint);
 
     key_t key = ftok(FTOK_PATH, FTOK_ID);
@@ -158,8 +795,15 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    /* 1) Crear y adjuntar memoria compartida */
-    shmid = shmget(key, sizeof(DatosCompartidos), IPC_CREAT | 0666);
+    /* 1) Crear y adjuntar memoria compartida. El segmento tiene que ser
+       nuevo: uno que quedó de una corrida anterior ya tiene sus páginas
+       ubicadas (ubicar_cola no tendría efecto) y puede ser de otro tamaño */
+    shmid = shmget(key, sizeof(DatosCompartidos), IPC_CREAT | IPC_EXCL | 0666);
+    if (shmid < 0 && errno == EEXIST) {
+        int viejo = shmget(key, 0, 0);
+        if (viejo >= 0) shmctl(viejo, IPC_RMID, NULL);
+        shmid = shmget(key, sizeof(DatosCompartidos), IPC_CREAT | IPC_EXCL | 0666);
+    }
     if (shmid < 0) {
         perror("shmget");
         exit(EXIT_FAILURE);
@@ -171,14 +815,33 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    /* Inicializar índices y contador de resultados */
-    datos->in_cv   = datos->out_cv   = 0;
-    datos->in_ve   = datos->out_ve   = 0;
-    datos->in_ec   = datos->out_ec   = 0;
-    datos->countResultados = 0;
+    /* Cada buffer vive en el nodo NUMA de su consumidor (antes de tocarlo) */
+    if (fijar_etapas) {
+        ubicar_cola(&datos->cv, cpus_etapa[ETAPA_VALIDAR]);
+        ubicar_cola(&datos->ve, cpus_etapa[ETAPA_ENCRIPTAR]);
+        ubicar_cola(&datos->ec, cpus_etapa[ETAPA_CLASIFICAR]);
+        if (politica_dedup != DEDUP_NO)
+            ubicar_cola(&datos->vd, cpus_etapa[ETAPA_DEDUP]);
+    }
 
-    /* 2) Crear 9 semáforos */
-    semid = semget(key, 9, IPC_CREAT | 0666);
+    /* Inicializar colas y contador de resultados */
+    inicializar_cola(&datos->cv, "CV", SEM_EMPTY_CV, capacidades[0]);
+    inicializar_cola(&datos->ve, "VE", SEM_EMPTY_VE, capacidades[1]);
+    inicializar_cola(&datos->ec, "EC", SEM_EMPTY_EC, capacidades[2]);
+    inicializar_cola(&datos->vd, "VD", SEM_EMPTY_VD, capacidades[1]);
+    datos->countResultados = 0;
+    datos->countRechazados = 0;
+    memset(datos->dnis, 0, sizeof(datos->dnis));
+    datos->countDuplicados = 0;
+
+    /* 2) Crear 8 semáforos. Como con la memoria, un conjunto que quedó de
+       una corrida anterior se descarta: puede tener otra cantidad */
+    semid = semget(key, NUM_SEMS, IPC_CREAT | IPC_EXCL | 0666);
+    if (semid < 0 && errno == EEXIST) {
+        int viejo = semget(key, 0, 0);
+        if (viejo >= 0) semctl(viejo, 0, IPC_RMID);
+        semid = semget(key, NUM_SEMS, IPC_CREAT | IPC_EXCL | 0666);
+    }
     if (semid < 0) {
         perror("semget");
         shmdt(datos);
@@ -186,11 +849,12 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    /* 3) Inicializar valores de semáforos: sem_empty = 3, sem_full = 0, sem_mutex = 1 */
-    unsigned short init_vals[9] = {
-        /* CV */ BUF_SIZE, 0, 1,
-        /* VE */ BUF_SIZE, 0, 1,
-        /* EC */ BUF_SIZE, 0, 1
+    /* 3) Inicializar valores de semáforos: sem_empty = capacidad, sem_full = 0 */
+    unsigned short init_vals[NUM_SEMS] = {
+        /* CV */ capacidades[0], 0,
+        /* VE */ capacidades[1], 0,
+        /* EC */ capacidades[2], 0,
+        /* VD */ capacidades[1], 0
     };
     if (semctl(semid, 0, SETALL, init_vals) < 0) {
         perror("semctl SETALL");
@@ -198,8 +862,9 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    /* 4) Crear los 4 procesos hijos */
-    for (int i = 0; i < 4; i++) {
+    /* 4) Crear los procesos hijos (4, o 5 con deduplicar) */
+    for (int i = 0; i < n_etapas; i++) {
+        int etapa = etapas[i];
         pid_t pid = fork();
         if (pid < 0) {
             perror("fork");
@@ -208,11 +873,14 @@ int main() {
         }
         if (pid == 0) {
             /* Cada hijo hereda “datos” y “semid” */
-            switch (i) {
-                case 0:  cargar_formularios();    break;
-                case 1:  validar_formularios();   break;
-                case 2:  encriptar_formularios(); break;
-                case 3:  clasificar_formularios();break;
+            if (cpus_etapa[etapa] >= 0)
+                fijar_cpu(cpus_etapa[etapa]);
+            switch (etapa) {
+                case ETAPA_CARGAR:     cargar_formularios();     break;
+                case ETAPA_VALIDAR:    validar_formularios();    break;
+                case ETAPA_DEDUP:      deduplicar_formularios(); break;
+                case ETAPA_ENCRIPTAR:  encriptar_formularios();  break;
+                case ETAPA_CLASIFICAR: clasificar_formularios(); break;
             }
             /* No debe llegar aquí, cada función hace exit() */
             exit(EXIT_SUCCESS);
@@ -220,24 +888,15 @@ int main() {
         /* El padre continúa al siguiente fork() */
     }
 
-    /* 5) Padre espera a que terminen los 4 hijos */
-    for (int i = 0; i < 4; i++) {
+    /* 5) Padre espera a que terminen los hijos */
+    for (int i = 0; i < n_etapas; i++) {
         wait(NULL);
     }
 
     /* 6) Todos los hijos terminaron; el padre imprime resultados */
-    printf("\n--- Resultados finales (%d formularios) ---\n",
-           datos->countResultados);
-    for (int i = 0; i < datos->countResultados; i++) {
-        Formulario *f = &datos->resultados[i];
-        printf("ID:%3d | DNI(encriptado):%8ld | Nombre: %-10s %-10s | FechaNac:%10s | Tel(encriptado):%-10s | Tipo:%-8s | Desc:%s\n",
-               f->id, f->dni,
-               f->nombre, f->apellido,
-               f->fechaNac,
-               f->nroTelefono,
-               f->tipoForm,
-               f->descripcion);
-    }
+    imprimir_resultados("Resultados finales");
+    imprimir_telemetria();
+    guardar_rechazados();
 
     /* 7) Limpiar IPC */
     quitar_ipc();
@@ -266,37 +925,47 @@ void cargar_formularios() {
         Formulario f;
         char *token;
 
-        /* Parsear CSV: id,dni,nombre,apellido,fechaNac,nroTelefono,descripcion */
-        token = strtok(linea, ",");
-        if (!token) continue;
+        /* Comentarios (p.ej. los de rechazados.txt al reprocesarlo) */
+        if (linea[0] == '#') continue;
+
+        /* Parsear CSV: id,dni,nombre,apellido,fechaNac,nroTelefono,descripcion.
+           Se usa strsep y no strtok porque los campos pueden venir vacíos
+           (",," en rechazados.txt) y strtok los saltearía corriendo las columnas */
+        char *resto = linea;
+        linea[strcspn(linea, "\r\n")] = '\0';
+
+        token = strsep(&resto, ",");
+        if (!resto) continue;
         f.id = atoi(token);
 
-        token = strtok(NULL, ",");  if (!token) continue;
+        token = strsep(&resto, ",");  if (!resto) continue;
         f.dni = atol(token);
 
-        token = strtok(NULL, ",");  if (!token) continue;
+        token = strsep(&resto, ",");  if (!resto) continue;
         strncpy(f.nombre, token, sizeof(f.nombre)-1);
         f.nombre[sizeof(f.nombre)-1] = '\0';
 
-        token = strtok(NULL, ",");  if (!token) continue;
+        token = strsep(&resto, ",");  if (!resto) continue;
         strncpy(f.apellido, token, sizeof(f.apellido)-1);
         f.apellido[sizeof(f.apellido)-1] = '\0';
 
-        token = strtok(NULL, ",");  if (!token) continue;
+        token = strsep(&resto, ",");  if (!resto) continue;
         strncpy(f.fechaNac, token, sizeof(f.fechaNac)-1);
         f.fechaNac[sizeof(f.fechaNac)-1] = '\0';
 
-        token = strtok(NULL, ",");  if (!token) continue;
+        token = strsep(&resto, ",");
         strncpy(f.nroTelefono, token, sizeof(f.nroTelefono)-1);
         f.nroTelefono[sizeof(f.nroTelefono)-1] = '\0';
 
-        token = strtok(NULL, "\n");
-        if (!token) token = "";
-        strncpy(f.descripcion, token, sizeof(f.descripcion)-1);
+        /* La descripción es el resto de la línea (puede tener comas o faltar) */
+        strncpy(f.descripcion, resto ? resto : "", sizeof(f.descripcion)-1);
         f.descripcion[sizeof(f.descripcion)-1] = '\0';
 
         /* Inicializar tipoForm vacío */
         f.tipoForm[0] = '\0';
+        f.motivos = 0;
+        f.duplicado = 0;
+        f.ranura_dni = -1;
 
         temp[total_leidos++] = f;
     }
@@ -308,53 +977,19 @@ void cargar_formularios() {
     /* 2) Producir uno a uno en buf_cv */
     for (int i = 0; i < total_leidos; i++) {
         Formulario f = temp[i];
-        struct sembuf op;
-
-        /* 2.1) Esperar espacio libre en buf_cv */
-        op = P(SEM_EMPTY_CV);
-        semop(semid, &op, 1);
-
-        /* 2.2) Entrar sección crítica buf_cv */
-        op = P(SEM_MUTEX_CV);
-        semop(semid, &op, 1);
-
-        /* 2.3) Escribir en buf_cv[in_cv] */
-        datos->buf_cv[datos->in_cv] = f;
-        datos->in_cv = (datos->in_cv + 1) % BUF_SIZE;
 
-        /* 2.4) Salir sección crítica buf_cv */
-        op = V(SEM_MUTEX_CV);
-        semop(semid, &op, 1);
-
-        /* 2.5) Señalar que hay un formulario listo en buf_cv */
-        op = V(SEM_FULL_CV);
-        semop(semid, &op, 1);
+        /* Espera espacio libre, escribe en buf_cv y señala formulario listo */
+        producir(&datos->cv, &f);
 
         printf(">> [CARGAR] Formulario ID %d producido en buf_cv.\n", f.id);
-        sleep(6);  /* para poder visualizar la concurrencia */
+        if (PAUSA_CARGA > 0)
+            sleep(PAUSA_CARGA);  /* para poder visualizar la concurrencia */
     }
 
     /* 3) Enviar sentinel (id = -1) */
     Formulario sentinel;
     sentinel.id = -1;
-
-    {
-        struct sembuf op;
-        op = P(SEM_EMPTY_CV);
-        semop(semid, &op, 1);
-
-        op = P(SEM_MUTEX_CV);
-        semop(semid, &op, 1);
-
-        datos->buf_cv[datos->in_cv] = sentinel;
-        datos->in_cv = (datos->in_cv + 1) % BUF_SIZE;
-
-        op = V(SEM_MUTEX_CV);
-        semop(semid, &op, 1);
-
-        op = V(SEM_FULL_CV);
-        semop(semid, &op, 1);
-    }
+    producir(&datos->cv, &sentinel);
 
     printf(">> [CARGAR] Sentinel enviado. Etapa CARGAR finalizada.\n");
     exit(EXIT_SUCCESS);
@@ -362,81 +997,96 @@ void cargar_formularios() {
 
 /* -----------------------------------------------
    Hijo 1: validar_formularios()
-   - Consume de buf_cv, valida y produce en buf_ve.
+   - Consume de buf_cv, valida y produce en buf_ve
+     (o en buf_vd si está activa la etapa deduplicar).
+   - Los inválidos no siguen: se apartan en rechazados[]
+     con la máscara de motivos.
    - Propaga sentinel al detectar id = -1.
    ----------------------------------------------- */
 void validar_formularios() {
+    Cola *salida = politica_dedup != DEDUP_NO ? &datos->vd : &datos->ve;
+
     while (1) {
         Formulario f;
-        struct sembuf op;
 
         /* Consumir de buf_cv */
-        op = P(SEM_FULL_CV);
-        semop(semid, &op, 1);
-
-        op = P(SEM_MUTEX_CV);
-        semop(semid, &op, 1);
-
-        f = datos->buf_cv[datos->out_cv];
-        datos->out_cv = (datos->out_cv + 1) % BUF_SIZE;
-
-        op = V(SEM_MUTEX_CV);
-        semop(semid, &op, 1);
-
-        op = V(SEM_EMPTY_CV);
-        semop(semid, &op, 1);
+        f = consumir(&datos->cv);
 
         /* Si es sentinel, propagar y terminar */
         if (f.id == -1) {
-            op = P(SEM_EMPTY_VE);
-            semop(semid, &op, 1);
-
-            op = P(SEM_MUTEX_VE);
-            semop(semid, &op, 1);
-
-            datos->buf_ve[datos->in_ve] = f;
-            datos->in_ve = (datos->in_ve + 1) % BUF_SIZE;
-
-            op = V(SEM_MUTEX_VE);
-            semop(semid, &op, 1);
-
-            op = V(SEM_FULL_VE);
-            semop(semid, &op, 1);
+            producir(salida, &f);
 
             printf(">> [VALIDAR] Sentinel detectado. Saliendo.\n");
             break;
         }
 
-        /* Validar campos: si hay error, avisar pero producir igual */
-        int error = 0;
-        if (f.dni <= 0)                error = 1;
-        if (strlen(f.nombre) == 0)     error = 1;
-        if (strlen(f.apellido) == 0)   error = 1;
-        if (strlen(f.fechaNac) == 0)   error = 1;
-        if (strlen(f.nroTelefono) == 0)error = 1;
-        if (strlen(f.descripcion) == 0)error = 1;
-
-        if (error) {
-            printf(">> [VALIDAR] Formulario ID %d inválido.\n", f.id);
-        } else {
-            printf(">> [VALIDAR] Formulario ID %d válido.\n", f.id);
+        /* Validar campos: acumular en la máscara cada control que falla */
+        f.motivos = 0;
+        if (f.id <= 0)                  f.motivos |= MOTIVO_ID;
+        if (f.dni <= 0)                 f.motivos |= MOTIVO_DNI;
+        if (strlen(f.nombre) == 0)      f.motivos |= MOTIVO_NOMBRE;
+        if (strlen(f.apellido) == 0)    f.motivos |= MOTIVO_APELLIDO;
+        if (strlen(f.fechaNac) == 0)    f.motivos |= MOTIVO_FECHA;
+        if (strlen(f.nroTelefono) == 0) f.motivos |= MOTIVO_TELEFONO;
+        if (strlen(f.descripcion) == 0) f.motivos |= MOTIVO_DESCRIPCION;
+
+        if (f.motivos) {
+            /* Apartar en la cola de rechazados: no pasa por encriptar/clasificar */
+            printf(">> [VALIDAR] Formulario ID %d inválido (motivos 0x%02x). Rechazado.\n",
+                   f.id, f.motivos);
+            int idx = datos->countRechazados;
+            if (idx < MAX_FORMULARIOS) {
+                datos->rechazados[idx] = f;
+                datos->countRechazados++;
+            }
+            continue;
         }
+        printf(">> [VALIDAR] Formulario ID %d válido.\n", f.id);
 
-        /* Producir en buf_ve */
-        op = P(SEM_EMPTY_VE);
-        semop(semid, &op, 1);
+        /* Producir en buf_ve / buf_vd */
+        producir(salida, &f);
+    }
 
-        op = P(SEM_MUTEX_VE);
-        semop(semid, &op, 1);
+    exit(EXIT_SUCCESS);
+}
 
-        datos->buf_ve[datos->in_ve] = f;
-        datos->in_ve = (datos->in_ve + 1) % BUF_SIZE;
+/* -----------------------------------------------
+   Hijo opcional: deduplicar_formularios()
+   - Consume de buf_vd, registra el DNI en el índice
+     compartido y produce en buf_ve según la política.
+   - Propaga sentinel al detectar id = -1.
+   ----------------------------------------------- */
+void deduplicar_formularios() {
+    while (1) {
+        Formulario f = consumir(&datos->vd);
 
-        op = V(SEM_MUTEX_VE);
-        semop(semid, &op, 1);
+        /* Si es sentinel, propagar y terminar */
+        if (f.id == -1) {
+            producir(&datos->ve, &f);
+
+            printf(">> [DEDUPLICAR] Sentinel detectado. Saliendo.\n");
+            break;
+        }
+
+        int repetido;
+        EntradaDni *e = registrar_dni(f.dni, f.id, &repetido);
+        if (e == NULL)
+            fprintf(stderr, ">> [DEDUPLICAR] Índice de DNIs lleno; ID %d pasa sin verificar.\n", f.id);
+        else
+            f.ranura_dni = (int)(e - datos->dnis);
+
+        if (repetido) {
+            datos->countDuplicados++;
+            if (politica_dedup == DEDUP_PRIMERO) {
+                printf(">> [DEDUPLICAR] Formulario ID %d con DNI repetido. Descartado.\n", f.id);
+                continue;
+            }
+            if (politica_dedup == DEDUP_MARCAR)
+                f.duplicado = 1;
+            printf(">> [DEDUPLICAR] Formulario ID %d con DNI repetido.\n", f.id);
+        }
 
-        op = V(SEM_FULL_VE);
-        semop(semid, &op, 1);
+        producir(&datos->ve, &f);
     }
 
     exit(EXIT_SUCCESS);
@@ -451,40 +1101,13 @@ void validar_formularios() {
 void encriptar_formularios() {
     while (1) {
         Formulario f;
-        struct sembuf op;
 
         /* Consumir de buf_ve */
-        op = P(SEM_FULL_VE);
-        semop(semid, &op, 1);
-
-        op = P(SEM_MUTEX_VE);
-        semop(semid, &op, 1);
-
-        f = datos->buf_ve[datos->out_ve];
-        datos->out_ve = (datos->out_ve + 1) % BUF_SIZE;
-
-        op = V(SEM_MUTEX_VE);
-        semop(semid, &op, 1);
-
-        op = V(SEM_EMPTY_VE);
-        semop(semid, &op, 1);
+        f = consumir(&datos->ve);
 
         /* Si es sentinel, propagar y terminar */
         if (f.id == -1) {
-            op = P(SEM_EMPTY_EC);
-            semop(semid, &op, 1);
-
-            op = P(SEM_MUTEX_EC);
-            semop(semid, &op, 1);
-
-            datos->buf_ec[datos->in_ec] = f;
-            datos->in_ec = (datos->in_ec + 1) % BUF_SIZE;
-
-            op = V(SEM_MUTEX_EC);
-            semop(semid, &op, 1);
-
-            op = V(SEM_FULL_EC);
-            semop(semid, &op, 1);
+            producir(&datos->ec, &f);
 
             printf(">> [ENCRIPTAR] Sentinel detectado. Saliendo.\n");
             break;
@@ -501,20 +1124,7 @@ void encriptar_formularios() {
         printf(">> [ENCRIPTAR] Formulario ID %d encriptado.\n", f.id);
 
         /* Producir en buf_ec */
-        op = P(SEM_EMPTY_EC);
-        semop(semid, &op, 1);
-
-        op = P(SEM_MUTEX_EC);
-        semop(semid, &op, 1);
-
-        datos->buf_ec[datos->in_ec] = f;
-        datos->in_ec = (datos->in_ec + 1) % BUF_SIZE;
-
-        op = V(SEM_MUTEX_EC);
-        semop(semid, &op, 1);
-
-        op = V(SEM_FULL_EC);
-        semop(semid, &op, 1);
+        producir(&datos->ec, &f);
     }
 
     exit(EXIT_SUCCESS);
@@ -529,23 +1139,9 @@ void encriptar_formularios() {
 void clasificar_formularios() {
     while (1) {
         Formulario f;
-        struct sembuf op;
 
         /* Consumir de buf_ec */
-        op = P(SEM_FULL_EC);
-        semop(semid, &op, 1);
-
-        op = P(SEM_MUTEX_EC);
-        semop(semid, &op, 1);
-
-        f = datos->buf_ec[datos->out_ec];
-        datos->out_ec = (datos->out_ec + 1) % BUF_SIZE;
-
-        op = V(SEM_MUTEX_EC);
-        semop(semid, &op, 1);
-
-        op = V(SEM_EMPTY_EC);
-        semop(semid, &op, 1);
+        f = consumir(&datos->ec);
 
         /* Si es sentinel, terminar */
         if (f.id == -1) {
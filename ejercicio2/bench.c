@@ -0,0 +1,481 @@
+/*
+ * bench.c
+ *
+ * Generador de carga para el servidor de Ahorcado:
+ * - Abre N conexiones concurrentes desde un solo proceso y las maneja con epoll
+ *   (sockets no bloqueantes, un estado por sesión; sin threads).
+ * - Cada sesión juega partidas automáticamente con una estrategia de letras y, al
+ *   terminar, manda PLAY para la siguiente o QUIT cuando ya jugó las pedidas (-g)
+ *   o se cumplió la duración (-d).
+ * - Al final informa partidas/seg, latencia de conexión (TCP y hasta el primer STATE)
+ *   y percentiles del RTT de cada jugada.
+ *
+ * Estrategias (-e):
+ *   frecuencia  letras en orden de frecuencia del castellano, una por TRY (por defecto)
+ *   alfabetica  de la 'a' a la 'z', una por TRY
+ *   aleatoria   una permutación al azar por partida, una por TRY
+ *   lote        todas las letras por frecuencia en un solo TRYN (una ida y vuelta)
+ *
+ * Uso: ./bench <IP_Servidor> <Puerto> [-n conexiones] [-g partidas] [-d segundos] [-e estrategia]
+ *
+ * Nota: el servidor admite por defecto pocos clientes a la vez (opción -c del
+ * servidor); el resto queda en espera con "BUSY:<posición>" y eso se ve en la
+ * latencia hasta el primer STATE.
+ *
+ * Autor: Tú mismo
+ * Fecha: 2025
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <time.h>
+
+#define MAX_EVENTOS 256
+#define TAM_ENTRADA 1024
+#define MAX_LINEA 256
+
+// Si no llega nada en este tiempo, las sesiones que quedan se dan por perdidas
+// (ej: conexiones que el servidor descartó por tener la cola de listen() llena)
+#define INACTIVIDAD_MAX_MS 10000
+
+#define CONEXIONES_DEFECTO 100
+#define PARTIDAS_DEFECTO 10
+
+const char *nombres_estrategias[] = { "frecuencia", "alfabetica", "aleatoria", "lote" };
+
+const char *orden_frecuencia = "eaosrnidlctumpbgvyqhfzjxkw";
+const char *orden_alfabetico = "abcdefghijklmnopqrstuvwxyz";
+
+typedef enum {
+    EST_FRECUENCIA,
+    EST_ALFABETICA,
+    EST_ALEATORIA,
+    EST_LOTE
+} estrategia_t;
+
+typedef enum {
+    FASE_CONECTANDO,
+    FASE_ESPERA_INICIAL,   // conectado, esperando el primer STATE (puede venir BUSY antes)
+    FASE_JUGANDO,
+    FASE_ESPERA_PLAY,      // mandó PLAY, espera el STATE de la partida nueva
+    FASE_ESPERA_BYE,
+    FASE_TERMINADA
+} fase_t;
+
+typedef struct {
+    int fd;
+    fase_t fase;
+
+    char entrada[TAM_ENTRADA];
+    int entrada_len;
+
+    char orden[27];        // letras a probar en esta partida
+    int siguiente;         // índice de la próxima letra
+    int paso;              // línea esperada de la respuesta: 0 STATE/ERROR, 1 extra, 2 GAMEOVER
+    int partidas;
+
+    long t_inicio;         // inicio del connect()
+    long t_envio;          // envío de la última jugada
+} sesion_t;
+
+// Muestras de latencia (ns) para calcular percentiles exactos al final
+typedef struct {
+    long *v;
+    size_t n, cap;
+} muestras_t;
+
+muestras_t lat_conexion, lat_primer_estado, lat_jugada;
+
+// Configuración y totales
+estrategia_t estrategia = EST_FRECUENCIA;
+int partidas_por_sesion = PARTIDAS_DEFECTO;
+long deadline_ns = 0;                // 0 = sin límite de tiempo
+long partidas_total = 0, ganadas_total = 0;
+long errores = 0;
+int sesiones_vivas = 0;
+int epfd;
+uint64_t semilla = 88172645463325252ULL;
+
+long ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void agregar_muestra(muestras_t *m, long ns) {
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 4096;
+        m->v = realloc(m->v, m->cap * sizeof(long));
+        if (!m->v) {
+            perror("realloc muestras");
+            exit(EXIT_FAILURE);
+        }
+    }
+    m->v[m->n++] = ns;
+}
+
+int comparar_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+void imprimir_percentiles(const char *nombre, muestras_t *m) {
+    if (m->n == 0) {
+        printf("%-22s sin muestras\n", nombre);
+        return;
+    }
+    qsort(m->v, m->n, sizeof(long), comparar_long);
+    double p[] = { 50, 90, 99, 99.9 };
+    printf("%-22s n=%-8zu", nombre, m->n);
+    for (int i = 0; i < 4; i++) {
+        size_t k = (size_t)(p[i] / 100.0 * (m->n - 1));
+        printf(" p%g=%.1fus", p[i], m->v[k] / 1000.0);
+    }
+    printf(" max=%.1fus\n", m->v[m->n - 1] / 1000.0);
+}
+
+uint64_t aleatorio() {
+    semilla ^= semilla >> 12;
+    semilla ^= semilla << 25;
+    semilla ^= semilla >> 27;
+    return semilla * 0x2545F4914F6CDD1DULL;
+}
+
+void enviar(sesion_t *s, const char *datos) {
+    size_t n = strlen(datos);
+    // Los comandos son cortos y el servidor responde antes del siguiente: send()
+    // no debería quedar corto con un socket sano
+    if (send(s->fd, datos, n, MSG_NOSIGNAL) != (ssize_t)n) {
+        errores++;
+        s->fase = FASE_TERMINADA;
+    }
+}
+
+void cerrar_sesion(sesion_t *s) {
+    if (s->fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+        close(s->fd);
+        s->fd = -1;
+    }
+    s->fase = FASE_TERMINADA;
+    sesiones_vivas--;
+}
+
+// Prepara el orden de letras de una partida nueva y manda la primera jugada
+void empezar_partida(sesion_t *s);
+
+void enviar_jugada(sesion_t *s) {
+    char cmd[40];
+    if (estrategia == EST_LOTE) {
+        snprintf(cmd, sizeof(cmd), "TRYN:%s\n", s->orden);
+        s->siguiente = 26;
+    } else {
+        snprintf(cmd, sizeof(cmd), "TRY:%c\n", s->orden[s->siguiente++]);
+    }
+    s->paso = 0;
+    s->t_envio = ahora_ns();
+    enviar(s, cmd);
+}
+
+void empezar_partida(sesion_t *s) {
+    switch (estrategia) {
+        case EST_ALFABETICA:
+            strcpy(s->orden, orden_alfabetico);
+            break;
+        case EST_ALEATORIA:
+            strcpy(s->orden, orden_alfabetico);
+            for (int i = 25; i > 0; i--) {
+                int j = aleatorio() % (i + 1);
+                char t = s->orden[i];
+                s->orden[i] = s->orden[j];
+                s->orden[j] = t;
+            }
+            break;
+        default:
+            strcpy(s->orden, orden_frecuencia);
+            break;
+    }
+    s->siguiente = 0;
+    s->fase = FASE_JUGANDO;
+    enviar_jugada(s);
+}
+
+// Fin de partida: sigue con PLAY o se despide con QUIT
+void terminar_partida(sesion_t *s, int gano) {
+    s->partidas++;
+    partidas_total++;
+    ganadas_total += gano;
+
+    int seguir = deadline_ns ? ahora_ns() < deadline_ns : s->partidas < partidas_por_sesion;
+    if (seguir) {
+        s->fase = FASE_ESPERA_PLAY;
+        s->t_envio = ahora_ns();
+        enviar(s, "PLAY\n");
+    } else {
+        s->fase = FASE_ESPERA_BYE;
+        enviar(s, "QUIT\n");
+    }
+}
+
+// Avanza la máquina de estados de la sesión con una línea de respuesta
+void procesar_linea(sesion_t *s, const char *linea) {
+    if (strncmp(linea, "ERROR:Server", 12) == 0) {
+        errores++;
+        s->fase = FASE_TERMINADA;
+        return;
+    }
+
+    switch (s->fase) {
+        case FASE_ESPERA_INICIAL:
+            if (strncmp(linea, "STATE:", 6) == 0) {
+                agregar_muestra(&lat_primer_estado, ahora_ns() - s->t_inicio);
+                empezar_partida(s);
+            } else if (strncmp(linea, "BUSY:", 5) != 0) {
+                errores++;
+                s->fase = FASE_TERMINADA;
+            }
+            break;
+
+        case FASE_JUGANDO:
+            if (s->paso == 0) {
+                if (strncmp(linea, "STATE:", 6) == 0) {
+                    s->paso = 1;          // falta el mensaje extra
+                } else {
+                    // ERROR de jugada: se cuenta y se prueba la letra siguiente
+                    errores++;
+                    agregar_muestra(&lat_jugada, ahora_ns() - s->t_envio);
+                    if (s->siguiente < 26) enviar_jugada(s);
+                    else s->fase = FASE_TERMINADA;
+                }
+            } else if (s->paso == 1) {
+                if (strncmp(linea, "WIN", 3) == 0 || strncmp(linea, "LOSE|", 5) == 0) {
+                    s->paso = 2;          // falta la línea GAMEOVER
+                } else {
+                    agregar_muestra(&lat_jugada, ahora_ns() - s->t_envio);
+                    if (s->siguiente < 26) enviar_jugada(s);
+                    else s->fase = FASE_TERMINADA;
+                }
+            } else {
+                agregar_muestra(&lat_jugada, ahora_ns() - s->t_envio);
+                terminar_partida(s, strncmp(linea, "GAMEOVER:WIN", 12) == 0);
+            }
+            break;
+
+        case FASE_ESPERA_PLAY:
+            if (strncmp(linea, "STATE:", 6) == 0) {
+                empezar_partida(s);
+            }
+            break;
+
+        case FASE_ESPERA_BYE:
+            s->fase = FASE_TERMINADA;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void atender_lectura(sesion_t *s) {
+    while (s->fase != FASE_TERMINADA) {
+        ssize_t n = recv(s->fd, s->entrada + s->entrada_len, sizeof(s->entrada) - s->entrada_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            if (s->fase != FASE_ESPERA_BYE) errores++;
+            s->fase = FASE_TERMINADA;
+            return;
+        }
+        s->entrada_len += n;
+
+        // Procesar todas las líneas completas
+        char *ini = s->entrada;
+        char *nl;
+        while (s->fase != FASE_TERMINADA &&
+               (nl = memchr(ini, '\n', s->entrada_len - (ini - s->entrada))) != NULL) {
+            char linea[MAX_LINEA];
+            int len = nl - ini < MAX_LINEA - 1 ? nl - ini : MAX_LINEA - 1;
+            memcpy(linea, ini, len);
+            linea[len] = '\0';
+            ini = nl + 1;
+            procesar_linea(s, linea);
+        }
+        s->entrada_len -= ini - s->entrada;
+        memmove(s->entrada, ini, s->entrada_len);
+        if (s->entrada_len == (int)sizeof(s->entrada)) s->entrada_len = 0;
+    }
+}
+
+int abrir_sesion(sesion_t *s, struct sockaddr_in *dir) {
+    memset(s, 0, sizeof(*s));
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    s->fase = FASE_CONECTANDO;
+    s->t_inicio = ahora_ns();
+    if (connect(s->fd, (struct sockaddr *)dir, sizeof(*dir)) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        close(s->fd);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = s;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+    sesiones_vivas++;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int conexiones = CONEXIONES_DEFECTO;
+    int duracion = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:g:d:e:")) != -1) {
+        switch (opt) {
+            case 'n': conexiones = atoi(optarg); break;
+            case 'g': partidas_por_sesion = atoi(optarg); break;
+            case 'd': duracion = atoi(optarg); break;
+            case 'e':
+                if (strcmp(optarg, "frecuencia") == 0) estrategia = EST_FRECUENCIA;
+                else if (strcmp(optarg, "alfabetica") == 0) estrategia = EST_ALFABETICA;
+                else if (strcmp(optarg, "aleatoria") == 0) estrategia = EST_ALEATORIA;
+                else if (strcmp(optarg, "lote") == 0) estrategia = EST_LOTE;
+                else {
+                    fprintf(stderr, "Estrategia inválida: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                goto uso;
+        }
+    }
+    if (argc - optind != 2 || conexiones < 1 || partidas_por_sesion < 1) {
+uso:
+        fprintf(stderr, "Uso: %s <IP_Servidor> <Puerto> [-n conexiones] [-g partidas] [-d segundos]\n"
+                        "          [-e frecuencia|alfabetica|aleatoria|lote]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Hace falta un descriptor por conexión: subir el límite blando al máximo
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    struct sockaddr_in dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.sin_family = AF_INET;
+    dir.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &dir.sin_addr) <= 0) {
+        fprintf(stderr, "Dirección inválida: %s\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    epfd = epoll_create1(0);
+    sesion_t *sesiones = calloc(conexiones, sizeof(sesion_t));
+    if (epfd < 0 || !sesiones) {
+        perror("epoll_create1/calloc");
+        exit(EXIT_FAILURE);
+    }
+    semilla ^= (uint64_t)time(NULL);
+
+    printf("Bench: %d conexiones a %s:%s, ", conexiones, argv[optind], argv[optind + 1]);
+    if (duracion > 0) printf("%d segundos", duracion);
+    else printf("%d partidas por conexión", partidas_por_sesion);
+    printf(", estrategia %s\n", nombres_estrategias[estrategia]);
+
+    long t0 = ahora_ns();
+    if (duracion > 0) deadline_ns = t0 + duracion * 1000000000L;
+
+    for (int i = 0; i < conexiones; i++) {
+        if (abrir_sesion(&sesiones[i], &dir) < 0) {
+            sesiones[i].fd = -1;
+            sesiones[i].fase = FASE_TERMINADA;
+            errores++;
+        }
+    }
+
+    struct epoll_event eventos[MAX_EVENTOS];
+    while (sesiones_vivas > 0) {
+        int n = epoll_wait(epfd, eventos, MAX_EVENTOS, INACTIVIDAD_MAX_MS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (n == 0) {
+            printf("Sin actividad por %d ms: se abandonan %d sesiones.\n", INACTIVIDAD_MAX_MS, sesiones_vivas);
+            for (int i = 0; i < conexiones; i++) {
+                if (sesiones[i].fd >= 0) {
+                    errores++;
+                    cerrar_sesion(&sesiones[i]);
+                }
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            sesion_t *s = eventos[i].data.ptr;
+
+            if (s->fase == FASE_CONECTANDO) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    errores++;
+                    cerrar_sesion(s);
+                    continue;
+                }
+                agregar_muestra(&lat_conexion, ahora_ns() - s->t_inicio);
+                s->fase = FASE_ESPERA_INICIAL;
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.ptr = s;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+            }
+
+            if (eventos[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                atender_lectura(s);
+            }
+            if (s->fase == FASE_TERMINADA) {
+                cerrar_sesion(s);
+            }
+        }
+    }
+    double segundos = (ahora_ns() - t0) / 1e9;
+
+    printf("\n===== RESULTADOS =====\n");
+    printf("Tiempo total:          %.3f s\n", segundos);
+    printf("Partidas jugadas:      %ld (%ld ganadas)\n", partidas_total, ganadas_total);
+    printf("Partidas/seg:          %.1f\n", partidas_total / segundos);
+    printf("Jugadas/seg:           %.1f\n", lat_jugada.n / segundos);
+    printf("Errores:               %ld\n", errores);
+    imprimir_percentiles("Conexión (TCP):", &lat_conexion);
+    imprimir_percentiles("Hasta primer STATE:", &lat_primer_estado);
+    imprimir_percentiles("RTT por jugada:", &lat_jugada);
+
+    free(sesiones);
+    close(epfd);
+    return 0;
+}
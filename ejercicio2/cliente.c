@@ -3,9 +3,14 @@
  *
  * Cliente para el Ahorcado:
  * - Se conecta al servidor, recibe el estado inicial y maneja TRY:<letra>, QUIT, HELP.
+ * - TRYN:<letras> manda varias letras en un solo comando (un único ida y vuelta).
+ * - Con un nombre como tercer argumento se identifica (HELLO:<nombre>) y el servidor
+ *   guarda sus partidas ganadas/perdidas. TOP muestra el ranking.
  * - Tras cada partida (GAMEOVER), pregunta "¿Querés jugar otra? (S/N)"
  *   Si responde "S", envía "PLAYSe perdió la conexión con el servidor. El juego se cerrará.\n" y empieza nueva partida sin reconectar.
  *   Si responde "N", envía "QUIT\n" y finaliza.
+ * - Si el servidor está lleno recibe "BUSY:<posición>", lo informa y sigue esperando.
+ * - Lee las respuestas línea por línea, sin suponer que cada recv() trae un mensaje entero.
  * - Ignora mensajes diferentes a "STATE:..." o "GAMEOVER:...".
  * - Maneja desconexión inesperada del servidor (SIGPIPE ignorado).
  *
@@ -27,13 +32,15 @@
 #include <arpa/inet.h>
 
 #define MAX_BUFFER 512
-#define MAX_INPUT 32  // Tamaño máximo de entrada usuario
+#define MAX_INPUT 40  // Tamaño máximo de entrada usuario (alcanza para TRYN con las 26 letras)
 
 // Muestra ayuda y reglas del juego
 void mostrar_ayuda() {
     printf("\n=== JUEGO DEL AHORCADO ===\n");
     printf("Comandos disponibles:\n");
     printf("  TRY:<letra>  - Intentar adivinar una letra (ej: TRY:a)\n");
+    printf("  TRYN:<letras>- Probar varias letras de una vez (ej: TRYN:aeiou)\n");
+    printf("  TOP          - Ver el ranking de jugadores\n");
     printf("  QUIT         - Salir del juego\n");
     printf("  HELP         - Mostrar esta ayuda\n");
     printf("\nReglas:\n");
@@ -76,9 +83,40 @@ int preguntar_replay() {
     }
 }
 
+// Bytes recibidos que todavía no forman una línea completa. El servidor puede mandar
+// varias líneas en un mismo segmento o una línea partida en varios.
+char buffer_entrada[MAX_BUFFER];
+int entrada_len = 0;
+
+// Devuelve la próxima línea recibida (sin '\n'). Devuelve su longitud, o -1 si hubo
+// error (errno indica timeout con EAGAIN) o el servidor cerró la conexión.
+int leer_linea(int sockfd, char *linea, size_t tam) {
+    while (1) {
+        char *nl = memchr(buffer_entrada, '\n', entrada_len);
+        if (nl) {
+            int len = nl - buffer_entrada;
+            int copia = len < (int)tam - 1 ? len : (int)tam - 1;
+            memcpy(linea, buffer_entrada, copia);
+            linea[copia] = '\0';
+            entrada_len -= len + 1;
+            memmove(buffer_entrada, nl + 1, entrada_len);
+            return copia;
+        }
+        if (entrada_len == (int)sizeof(buffer_entrada)) {
+            entrada_len = 0;  // Línea demasiado larga: se descarta
+        }
+        int bytes = recv(sockfd, buffer_entrada + entrada_len, sizeof(buffer_entrada) - entrada_len, 0);
+        if (bytes <= 0) {
+            if (bytes == 0) errno = 0;
+            return -1;
+        }
+        entrada_len += bytes;
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Uso: %s <IP_Servidor> <Puerto>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Uso: %s <IP_Servidor> <Puerto> [nombre]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -105,7 +143,7 @@ int main(int argc, char *argv[]) {
     }
 
     printf("Conectando a %s:%d …\n", ip_servidor, puerto);
-    // connect() bloqueará si el servidor ya tiene MAX_CLIENTES activos:
+    // Si el servidor ya tiene max_clientes activos, responderá "BUSY:<posición>":
     if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
         perror("connect");
         close(sockfd);
@@ -117,22 +155,28 @@ int main(int argc, char *argv[]) {
 
     char buffer_recv[MAX_BUFFER];
     char buffer_send[MAX_INPUT];
-    int bytes;
 
-    // ========== Recibir estado inicial (espera bloqueo si hay 5 clientes) ==========
+    // ========== Recibir estado inicial (o la posición en la cola si está lleno) ==========
     printf("Esperando a que el servidor envíe el estado inicial…\n");
-    memset(buffer_recv, 0, sizeof(buffer_recv));
-    bytes = recv(sockfd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-    if (bytes <= 0) {
+    if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) < 0) {
         printf("Error o desconexión antes de recibir estado inicial.\n");
         close(sockfd);
         return 1;
     }
-    buffer_recv[bytes] = '\0';
+
+    // Servidor lleno: nos dice nuestra posición en la cola y el STATE llega al entrar
+    while (strncmp(buffer_recv, "BUSY:", 5) == 0) {
+        printf("Servidor lleno. Posición en la cola de espera: %d\n", atoi(buffer_recv + 5));
+        if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) < 0) {
+            printf("Error o desconexión mientras se esperaba lugar en el servidor.\n");
+            close(sockfd);
+            return 1;
+        }
+    }
 
     // Puede venir "ERROR:" si el servidor está cerrándose
     if (strncmp(buffer_recv, "ERROR:", 6) == 0) {
-        printf("%s", buffer_recv);
+        printf("%s\n", buffer_recv);
         close(sockfd);
         return 1;
     }
@@ -147,17 +191,30 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Podría llegar "STATE:...|...|...\n¡Acierto!" o "STATE:…\n" si no hay extra
-    // En cualquier caso, procesamos la línea STATE y descartamos el resto por ahora
+    // El estado inicial es una sola línea STATE, sin mensaje extra
     if (strncmp(buffer_recv, "STATE:", 6) == 0) {
-        // Extraer parte hasta la primera línea nueva
-        char *newline = strchr(buffer_recv, '\n');
-        if (newline) {
-            *newline = '\0';
-        }
         procesar_estado(buffer_recv);
     }
 
+    // Identificarse: "OK:HELLO:<nombre>|<ganadas>|<perdidas>" o un ERROR
+    if (argc == 4) {
+        char hello[MAX_BUFFER];
+        snprintf(hello, sizeof(hello), "HELLO:%s\n", argv[3]);
+        char nombre[MAX_BUFFER];
+        int ganadas, perdidas;
+        if (send(sockfd, hello, strlen(hello), 0) < 0 ||
+            leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) < 0) {
+            printf("Se perdió la conexión con el servidor. El juego se cerrará.\n");
+            close(sockfd);
+            return 1;
+        }
+        if (sscanf(buffer_recv, "OK:HELLO:%[^|]|%d|%d", nombre, &ganadas, &perdidas) == 3) {
+            printf("Jugador: %s (%d ganadas, %d perdidas)\n", nombre, ganadas, perdidas);
+        } else {
+            printf("%s\n", buffer_recv);
+        }
+    }
+
     // ========== Bucle principal de juego ==========
     while (1) {
         // Leer comando del usuario
@@ -181,25 +238,47 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
+        // TOP: una línea "TOP:nombre:ganadas:perdidas|..."
+        if (strcmp(buffer_send, "TOP") == 0) {
+            send(sockfd, "TOP\n", 4, 0);
+            if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) < 0) {
+                printf("\nSe perdió la conexión con el servidor. El juego se cerrará.\n");
+                break;
+            }
+            printf("\n=== RANKING ===\n");
+            int puesto = 1;
+            for (char *e = strtok(buffer_recv + 4, "|"); e; e = strtok(NULL, "|")) {
+                char nombre[MAX_BUFFER];
+                int ganadas, perdidas;
+                if (sscanf(e, "%[^:]:%d:%d", nombre, &ganadas, &perdidas) == 3) {
+                    printf("%2d. %-16s %d ganadas, %d perdidas\n", puesto++, nombre, ganadas, perdidas);
+                }
+            }
+            if (puesto == 1) printf("(todavía nadie ganó una partida)\n");
+            continue;
+        }
+
         // QUIT
         if (strcmp(buffer_send, "QUIT") == 0) {
             send(sockfd, "QUIT\n", 5, 0);
-            memset(buffer_recv, 0, sizeof(buffer_recv));
-            bytes = recv(sockfd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-            if (bytes > 0) {
-                buffer_recv[bytes] = '\0';
-                printf("%s", buffer_recv);  // "BYE\n"
+            if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) >= 0) {
+                printf("%s\n", buffer_recv);  // "BYE"
             }
             break;
         }
 
-        // Validar TRY:<letra>
-        if (strncmp(buffer_send, "TRY:", 4) != 0 || strlen(buffer_send) != 5) {
+        // Validar TRY:<letra> o TRYN:<letras>
+        int es_lote = strncmp(buffer_send, "TRYN:", 5) == 0 && strlen(buffer_send) > 5;
+        if (!es_lote && (strncmp(buffer_send, "TRY:", 4) != 0 || strlen(buffer_send) != 5)) {
             printf("Formato inválido. Use TRY:<letra> (ej: TRY:a) o escriba HELP.\n");
             continue;
         }
-        buffer_send[4] = tolower(buffer_send[4]);
-        if (!isalpha(buffer_send[4])) {
+        int letras_ok = 1;
+        for (char *p = buffer_send + (es_lote ? 5 : 4); *p; p++) {
+            *p = tolower(*p);
+            if (!isalpha(*p)) letras_ok = 0;
+        }
+        if (!letras_ok) {
             printf("Error: Debe ingresar una letra válida (a-z).\n");
             continue;
         }
@@ -216,10 +295,14 @@ int main(int argc, char *argv[]) {
             break;
         }
 
-        // Recibir respuesta: puede incluir STATE + mensaje extra + GAMEOVER en un solo bloque
-        memset(buffer_recv, 0, sizeof(buffer_recv));
-        bytes = recv(sockfd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-        if (bytes <= 0) {
+        // Recibir respuesta: una línea "ERROR:..." o bien "STATE:...", el mensaje extra
+        // ("¡Acierto!", "Letra incorrecta", "BATCH:...", "WIN" o "LOSE|...") y, si terminó,
+        // "GAMEOVER:...". Cada línea termina en '\n' y pueden llegar juntas o partidas.
+        char estado_line[MAX_BUFFER] = {0};
+        char extra_line[MAX_BUFFER] = {0};
+        char gameover_line[MAX_BUFFER] = {0};
+
+        if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 printf("\nTimeout esperando respuesta del servidor. El servidor podría estar caído.\n");
                 printf("Se perdió la conexión con el servidor. El juego se cerrará.\n");
@@ -229,7 +312,6 @@ int main(int argc, char *argv[]) {
             }
             break;
         }
-        buffer_recv[bytes] = '\0';
 
         // Si viene "ERROR:" (raro en el juego normal), mostramos y salimos
         if (strncmp(buffer_recv, "ERROR:", 6) == 0) {
@@ -246,30 +328,20 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        // 1) Separar en líneas: "STATE:..." posible "¡Acierto!"/¡Letra incorrecta" y luego "GAMEOVER:..."
-        //    Cada línea termina en '\n'. Podemos tokenizar por "\n".
-        char *line = NULL;
-        char *rest = buffer_recv;
-        int line_num = 0;
-        char estado_line[MAX_BUFFER] = {0};
-        char extra_line[MAX_BUFFER] = {0};
-        char gameover_line[MAX_BUFFER] = {0};
-
-        while ((line = strsep(&rest, "\n")) != NULL) {
-            if (strlen(line) == 0) continue;
-            if (strncmp(line, "STATE:", 6) == 0) {
-                strncpy(estado_line, line, sizeof(estado_line) - 1);
-                line_num++;
-            } else if (strncmp(line, "WIN", 3) == 0 ||
-                       strncmp(line, "LOSE|", 5) == 0 ||
-                       strcmp(line, "¡Acierto!") == 0 ||
-                       strcmp(line, "Letra incorrecta") == 0) {
-                // Esta línea es mensaje extra o parte del STATE
-                strncpy(extra_line, line, sizeof(extra_line) - 1);
-                line_num++;
-            } else if (strncmp(line, "GAMEOVER:", 9) == 0) {
-                strncpy(gameover_line, line, sizeof(gameover_line) - 1);
-                line_num++;
+        if (strncmp(buffer_recv, "STATE:", 6) == 0) {
+            strncpy(estado_line, buffer_recv, sizeof(estado_line) - 1);
+            if (leer_linea(sockfd, extra_line, sizeof(extra_line)) < 0) {
+                printf("\nEl servidor se desconectó inesperadamente.\n");
+                printf("Se perdió la conexión con el servidor. El juego se cerrará.\n");
+                break;
+            }
+            // Tras WIN o LOSE el servidor agrega la línea GAMEOVER
+            if (strncmp(extra_line, "WIN", 3) == 0 || strncmp(extra_line, "LOSE|", 5) == 0) {
+                if (leer_linea(sockfd, gameover_line, sizeof(gameover_line)) < 0) {
+                    printf("\nEl servidor se desconectó inesperadamente.\n");
+                    printf("Se perdió la conexión con el servidor. El juego se cerrará.\n");
+                    break;
+                }
             }
         }
 
@@ -277,12 +349,15 @@ int main(int argc, char *argv[]) {
         if (strlen(estado_line) > 0) {
             procesar_estado(estado_line);
         }
-        if (strlen(extra_line) > 0) {
+        int aciertos, fallos, ignoradas;
+        if (sscanf(extra_line, "BATCH:%d|%d|%d", &aciertos, &fallos, &ignoradas) == 3) {
+            printf("Aciertos: %d, fallos: %d, ignoradas: %d\n", aciertos, fallos, ignoradas);
+        } else if (strlen(extra_line) > 0) {
             printf("%s\n", extra_line);
         }
 
         // 3) Si encontramos "GAMEOVER:", procesarlo y preguntar replay
-        if (strlen(gameover_line) > 0) {
+        if (strncmp(gameover_line, "GAMEOVER:", 9) == 0) {
             if (strncmp(gameover_line, "GAMEOVER:WIN", 12) == 0) {
                 printf("\n¡¡FELICITACIONES!! ¡Has ganado esta partida!\n");
             } else if (strncmp(gameover_line, "GAMEOVER:LOSE:", 14) == 0) {
@@ -304,26 +379,19 @@ int main(int argc, char *argv[]) {
                     break;
                 }
                 // Esperar nuevo STATE inicial
-                memset(buffer_recv, 0, sizeof(buffer_recv));
-                bytes = recv(sockfd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-                if (bytes <= 0) {
+                if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) < 0) {
                     printf("\nEl servidor se desconectó al iniciar nueva partida.\n");
                     printf("Se perdió la conexión con el servidor. El juego se cerrará.\n");
                     break;
                 }
-                buffer_recv[bytes] = '\0';
-                // El buffer debe contener "STATE:..."; lo procesamos tal cual
                 if (strncmp(buffer_recv, "STATE:", 6) == 0) {
                     procesar_estado(buffer_recv);
                 }
                 continue;  // Volver a bucle de juego
             } else {
                 send(sockfd, "QUIT\n", 5, 0);
-                memset(buffer_recv, 0, sizeof(buffer_recv));
-                bytes = recv(sockfd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-                if (bytes > 0) {
-                    buffer_recv[bytes] = '\0';
-                    printf("%s", buffer_recv);  // "BYE\n"
+                if (leer_linea(sockfd, buffer_recv, sizeof(buffer_recv)) >= 0) {
+                    printf("%s\n", buffer_recv);  // "BYE"
                 }
                 break;
             }
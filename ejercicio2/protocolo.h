@@ -0,0 +1,56 @@
+/*
+ * protocolo.h
+ *
+ * Formato binario opcional de las respuestas del servidor de Ahorcado.
+ *
+ * - El protocolo por defecto es de texto ("STATE:palabra|intentos|letras\n", ...),
+ *   que es el que usa cliente.c.
+ * - Un cliente puede pedir respuestas binarias enviando la línea "BIN". El servidor
+ *   contesta "OK:BIN\n" (todavía en texto) y desde ahí cada respuesta es una trama:
+ *   una cabecera fija de 10 bytes seguida de 'largo' bytes de carga útil.
+ * - Los comandos del cliente (TRY, TRYN, PLAY, QUIT, HELLO, TOP, JOIN, LEAVE) siguen
+ *   siendo líneas de texto.
+ * - En una sala (JOIN:<sala>) las tramas STATE/GAMEOVER son las de la partida
+ *   compartida y llegan cada vez que cualquier miembro juega. El resultado final
+ *   cuenta para el registro (HELLO) de todos los que estaban en la sala.
+ *
+ * Autor: Tú mismo
+ * Fecha: 2025
+ */
+
+#ifndef PROTOCOLO_H
+#define PROTOCOLO_H
+
+#include <stdint.h>
+
+// Línea que activa el modo binario y su confirmación
+#define CMD_BINARIO "BIN"
+#define OK_BINARIO  "OK:BIN\n"
+
+// Tipos de trama (opcode)
+#define OP_STATE    1   // carga: palabra con las letras reveladas ('_' las ocultas)
+#define OP_GAMEOVER 2   // carga: palabra real; detalle: DET_WIN o DET_LOSE
+#define OP_ERROR    3   // carga: texto del error (ej: "ERROR:Letra ya usada")
+#define OP_BYE      4   // sin carga
+#define OP_INFO     5   // carga: respuesta en texto a HELLO ("OK:HELLO:..."), TOP ("TOP:..."),
+                        // JOIN ("OK:JOIN:sala|miembros") o LEAVE ("OK:LEAVE")
+
+// Detalle de una trama STATE/GAMEOVER (lo que en texto es la segunda línea)
+#define DET_NINGUNO 0
+#define DET_ACIERTO 1
+#define DET_FALLO   2
+#define DET_WIN     3
+#define DET_LOSE    4
+#define DET_BATCH   5   // respuesta a TRYN sin fin de partida
+
+// Cabecera fija. Los campos de más de un byte van en orden de red.
+typedef struct __attribute__((packed)) {
+    uint8_t  opcode;
+    uint8_t  intentos;    // intentos restantes
+    uint8_t  detalle;     // DET_*
+    uint8_t  reservado;
+    uint32_t letras;      // letras usadas: bit i = letra 'a' + i
+    uint16_t largo;       // bytes de carga útil que siguen a la cabecera
+} cabecera_bin_t;
+
+#endif
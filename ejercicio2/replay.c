@@ -0,0 +1,759 @@
+/*
+ * replay.c
+ *
+ * Reproductor de trazas del servidor de Ahorcado (grabadas con ./servidor -r):
+ * - Lee la traza (ver traza.h), arma una sesión por conexión grabada y las vuelve a
+ *   abrir contra el servidor respetando cuándo entró cada una y cuándo mandó cada
+ *   comando, así la carga tiene la misma forma (cuántas a la vez, ritmo de comandos).
+ * - Velocidad (-v): 1 = tiempo real, N = N veces más rápido, max = sin esperas (todas
+ *   las sesiones arrancan juntas y cada una manda el comando siguiente apenas recibe
+ *   la respuesta). Una sesión nunca tiene más de un comando sin responder: si el
+ *   servidor tarda más que en la captura, el resto de esa sesión se corre (se informa
+ *   como atraso respecto de la traza).
+ * - Las palabras se sortean de nuevo, así que las partidas no terminan en la misma
+ *   jugada que en la captura. Se resincroniza en los bordes de partida: si la partida
+ *   ya terminó, se saltean los TRY/TRYN que quedan de la grabada; si la grabada terminó
+ *   antes (llega un PLAY con la partida en curso), se la termina con un TRYN de todas
+ *   las letras, que no se mide. En una sala (JOIN) los comandos se mandan tal cual y
+ *   la latencia es hasta lo primero que llega (puede ser la difusión de otra jugada).
+ * - Al final informa percentiles de latencia por tipo de comando. Con -o guarda ese
+ *   resumen y con -b lo compara contra uno anterior: informa la diferencia de p50 y
+ *   p99 por comando y, con -u, termina con código 2 si algún p99 empeoró más que el
+ *   umbral (para cortar un despliegue con una regresión de rendimiento).
+ *
+ * Uso: ./replay <IP_Servidor> <Puerto> <traza> [-v velocidad|max] [-o resumen]
+ *               [-b resumen_base] [-u umbral_pct]
+ *
+ * Autor: Tú mismo
+ * Fecha: 2025
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <time.h>
+#include <endian.h>
+
+#include "protocolo.h"
+#include "traza.h"
+
+#define MAX_EVENTOS 256
+#define TAM_ENTRADA 4096
+#define MAX_LINEA 256
+
+// Si no llega nada en este tiempo (y no hay nada agendado), las sesiones que esperan
+// respuesta se dan por perdidas
+#define INACTIVIDAD_MAX_MS 10000
+
+// Muestras mínimas de un comando para juzgar una regresión contra el resumen base
+#define MIN_MUESTRAS_COMPARACION 30
+
+// Jugada que termina cualquier partida en curso (resincronización)
+#define CMD_TERMINAR "TRYN:abcdefghijklmnopqrstuvwxyz\n"
+
+// Tipos de comando, con los mismos nombres que las métricas del servidor, más el
+// tiempo hasta el primer STATE de cada conexión
+typedef enum {
+    TIPO_CONEXION,
+    TIPO_TRY,
+    TIPO_TRYN,
+    TIPO_PLAY,
+    TIPO_QUIT,
+    TIPO_OTRO,
+    NUM_TIPOS
+} tipo_t;
+
+const char *nombres_tipos[NUM_TIPOS] = { "CONEXION", "TRY", "TRYN", "PLAY", "QUIT", "OTRO" };
+
+typedef enum {
+    FASE_PROGRAMADA,       // todavía no llegó su hora de conectarse
+    FASE_CONECTANDO,
+    FASE_ESPERA_INICIAL,   // conectado, esperando el primer STATE (puede venir BUSY antes)
+    FASE_LISTA,            // esperando la hora del comando siguiente
+    FASE_ESPERANDO,        // mandó un comando, espera la respuesta
+    FASE_TERMINADA
+} fase_t;
+
+// Un registro de la traza, ya en orden de host
+typedef struct {
+    long t_us;
+    uint32_t conexion;
+    uint8_t tipo;
+    uint8_t largo;
+    const char *comando;   // apunta dentro de la traza cargada (sin '\0')
+    size_t orden;          // posición en el archivo, para ordenar de forma estable
+} evento_t;
+
+typedef struct {
+    int fd;
+    fase_t fase;
+
+    evento_t *comandos;    // comandos grabados de la conexión, en orden
+    int num_comandos;
+    int siguiente;
+    long t_inicio_us;      // entrada de la conexión en la traza
+    long t_fin_us;         // cierre en la traza (-1: no se grabó)
+
+    char entrada[TAM_ENTRADA];
+    int entrada_len;
+    int binario;           // el servidor ya contesta en tramas
+    int en_partida;        // hay una partida propia en curso
+    int en_sala;
+    int respondio;         // llegó algo de la respuesta al comando en curso
+
+    tipo_t tipo_espera;    // comando en curso (se mide al completarse la respuesta)
+    int resincronizando;   // el comando en curso es CMD_TERMINAR
+    long t_envio;
+} sesion_t;
+
+// Muestras de latencia (ns) para calcular percentiles exactos al final
+typedef struct {
+    long *v;
+    size_t n, cap;
+} muestras_t;
+
+muestras_t latencias[NUM_TIPOS], atrasos;
+
+// Agenda: montículo de (hora, sesión) con lo próximo que tiene que hacer cada sesión
+typedef struct {
+    long t;
+    sesion_t *s;
+} cita_t;
+
+cita_t *agenda = NULL;
+size_t num_citas = 0, cap_citas = 0;
+
+// Configuración y totales
+double velocidad = 1.0;    // 0 = max
+long t0 = 0;               // hora de la replay que corresponde a 'origen_us' de la traza
+long origen_us = 0;        // entrada de la primera conexión grabada
+long enviados = 0, omitidos = 0, resincronizaciones = 0, errores = 0;
+int sesiones_vivas = 0;
+int epfd;
+struct sockaddr_in dir;
+
+long ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Hora de la replay (ns de CLOCK_MONOTONIC) de un instante de la traza
+long hora_de(long t_us) {
+    if (velocidad == 0) return t0;
+    return t0 + (long)((t_us - origen_us) * 1000 / velocidad);
+}
+
+void agregar_muestra(muestras_t *m, long ns) {
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 4096;
+        m->v = realloc(m->v, m->cap * sizeof(long));
+        if (!m->v) {
+            perror("realloc muestras");
+            exit(EXIT_FAILURE);
+        }
+    }
+    m->v[m->n++] = ns;
+}
+
+int comparar_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Percentil p de muestras ya ordenadas
+long percentil(const muestras_t *m, double p) {
+    return m->v[(size_t)(p / 100.0 * (m->n - 1))];
+}
+
+void imprimir_percentiles(const char *nombre, muestras_t *m) {
+    if (m->n == 0) {
+        printf("%-22s sin muestras\n", nombre);
+        return;
+    }
+    qsort(m->v, m->n, sizeof(long), comparar_long);
+    double p[] = { 50, 90, 99, 99.9 };
+    printf("%-22s n=%-8zu", nombre, m->n);
+    for (int i = 0; i < 4; i++) {
+        printf(" p%g=%.1fus", p[i], percentil(m, p[i]) / 1000.0);
+    }
+    printf(" max=%.1fus\n", m->v[m->n - 1] / 1000.0);
+}
+
+// ======================= Agenda =======================
+void agendar(sesion_t *s, long t) {
+    if (num_citas == cap_citas) {
+        cap_citas = cap_citas ? cap_citas * 2 : 1024;
+        agenda = realloc(agenda, cap_citas * sizeof(cita_t));
+        if (!agenda) {
+            perror("realloc agenda");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t i = num_citas++;
+    while (i > 0 && agenda[(i - 1) / 2].t > t) {
+        agenda[i] = agenda[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    agenda[i].t = t;
+    agenda[i].s = s;
+}
+
+cita_t sacar_cita() {
+    cita_t primera = agenda[0];
+    cita_t ultima = agenda[--num_citas];
+    size_t i = 0;
+    while (2 * i + 1 < num_citas) {
+        size_t h = 2 * i + 1;
+        if (h + 1 < num_citas && agenda[h + 1].t < agenda[h].t) h++;
+        if (agenda[h].t >= ultima.t) break;
+        agenda[i] = agenda[h];
+        i = h;
+    }
+    agenda[i] = ultima;
+    return primera;
+}
+
+// ======================= Carga de la traza =======================
+int comparar_eventos(const void *a, const void *b) {
+    const evento_t *x = a, *y = b;
+    if (x->conexion != y->conexion) return x->conexion < y->conexion ? -1 : 1;
+    return (x->orden > y->orden) - (x->orden < y->orden);
+}
+
+// Lee la traza y arma una sesión por conexión. Devuelve la cantidad de sesiones.
+int cargar_traza(const char *ruta, sesion_t **sesiones) {
+    FILE *f = fopen(ruta, "rb");
+    struct stat st;
+    if (!f || fstat(fileno(f), &st) < 0) {
+        perror(ruta);
+        return -1;
+    }
+    char *datos = malloc(st.st_size + 1);
+    if (!datos || fread(datos, 1, st.st_size, f) != (size_t)st.st_size) {
+        perror("lectura de la traza");
+        return -1;
+    }
+    fclose(f);
+    if (st.st_size < TRAZA_LARGO_MAGIA || memcmp(datos, TRAZA_MAGIA, TRAZA_LARGO_MAGIA) != 0) {
+        fprintf(stderr, "%s no es una traza del servidor\n", ruta);
+        return -1;
+    }
+
+    // Registros en orden de archivo (la traza queda en memoria: los comandos apuntan a ella)
+    size_t cap = 1024, n = 0;
+    evento_t *eventos = malloc(cap * sizeof(evento_t));
+    size_t pos = TRAZA_LARGO_MAGIA;
+    while (eventos && pos + sizeof(registro_traza_t) <= (size_t)st.st_size) {
+        registro_traza_t r;
+        memcpy(&r, datos + pos, sizeof(r));
+        pos += sizeof(r);
+        if (pos + r.largo > (size_t)st.st_size) break;  // registro cortado al final
+        if (n == cap) {
+            cap *= 2;
+            eventos = realloc(eventos, cap * sizeof(evento_t));
+            if (!eventos) break;
+        }
+        eventos[n].t_us = be64toh(r.t_us);
+        eventos[n].conexion = ntohl(r.conexion);
+        eventos[n].tipo = r.tipo;
+        eventos[n].largo = r.largo;
+        eventos[n].comando = datos + pos;
+        eventos[n].orden = n;
+        n++;
+        pos += r.largo;
+    }
+    if (!eventos) {
+        perror("malloc eventos");
+        return -1;
+    }
+    qsort(eventos, n, sizeof(evento_t), comparar_eventos);
+
+    // Cada tramo de eventos de una misma conexión es una sesión
+    int num = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || eventos[i].conexion != eventos[i - 1].conexion) num++;
+    }
+    *sesiones = calloc(num ? num : 1, sizeof(sesion_t));
+    evento_t *comandos = malloc((n ? n : 1) * sizeof(evento_t));
+    if (!*sesiones || !comandos) {
+        perror("calloc sesiones");
+        return -1;
+    }
+
+    int k = -1;
+    size_t nc = 0;
+    for (size_t i = 0; i < n; i++) {
+        evento_t *e = &eventos[i];
+        if (i == 0 || e->conexion != eventos[i - 1].conexion) {
+            sesion_t *s = &(*sesiones)[++k];
+            s->fd = -1;
+            s->comandos = comandos + nc;
+            s->t_inicio_us = e->t_us;
+            s->t_fin_us = -1;
+        }
+        sesion_t *s = &(*sesiones)[k];
+        if (e->tipo == TRAZA_CONEXION) {
+            s->t_inicio_us = e->t_us;
+        } else if (e->tipo == TRAZA_COMANDO) {
+            comandos[nc++] = *e;
+            s->num_comandos++;
+        } else if (e->tipo == TRAZA_CIERRE) {
+            s->t_fin_us = e->t_us;
+        }
+    }
+    free(eventos);
+    return num;
+}
+
+// ======================= Sesiones =======================
+tipo_t tipo_de(const evento_t *e) {
+    if (e->largo == 5 && strncmp(e->comando, "TRY:", 4) == 0) return TIPO_TRY;
+    if (e->largo > 5 && strncmp(e->comando, "TRYN:", 5) == 0) return TIPO_TRYN;
+    if (e->largo == 4 && strncmp(e->comando, "PLAY", 4) == 0) return TIPO_PLAY;
+    if (e->largo == 4 && strncmp(e->comando, "QUIT", 4) == 0) return TIPO_QUIT;
+    return TIPO_OTRO;
+}
+
+void cerrar_sesion(sesion_t *s) {
+    if (s->fase == FASE_TERMINADA) return;
+    if (s->fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+        close(s->fd);
+        s->fd = -1;
+    }
+    if (s->fase != FASE_PROGRAMADA) sesiones_vivas--;
+    s->fase = FASE_TERMINADA;
+}
+
+void enviar(sesion_t *s, const char *datos, size_t n) {
+    // Un solo comando sin responder por sesión: send() no debería quedar corto
+    if (send(s->fd, datos, n, MSG_NOSIGNAL) != (ssize_t)n) {
+        errores++;
+        cerrar_sesion(s);
+        return;
+    }
+    s->t_envio = ahora_ns();
+    s->respondio = 0;
+    s->fase = FASE_ESPERANDO;
+}
+
+// Agenda lo próximo de una sesión lista: su comando siguiente o, si ya no quedan, el
+// cierre (si la conexión grabada no terminó con un QUIT que el servidor cierra solo)
+void agendar_siguiente(sesion_t *s) {
+    s->fase = FASE_LISTA;
+    if (s->siguiente < s->num_comandos) {
+        agendar(s, hora_de(s->comandos[s->siguiente].t_us));
+    } else {
+        agendar(s, s->t_fin_us >= 0 ? hora_de(s->t_fin_us) : ahora_ns());
+    }
+}
+
+// Manda el comando que toca, resincronizando en los bordes de partida
+void enviar_siguiente(sesion_t *s) {
+    while (s->siguiente < s->num_comandos) {
+        evento_t *e = &s->comandos[s->siguiente];
+        tipo_t tipo = tipo_de(e);
+        if (!s->en_sala && !s->en_partida && (tipo == TIPO_TRY || tipo == TIPO_TRYN)) {
+            // La partida ya terminó acá: lo que sigue de la grabada no corresponde
+            omitidos++;
+            s->siguiente++;
+            continue;
+        }
+        if (!s->en_sala && s->en_partida && tipo == TIPO_PLAY) {
+            // La grabada ya había terminado: terminar esta y mandar el PLAY después
+            resincronizaciones++;
+            s->resincronizando = 1;
+            enviar(s, CMD_TERMINAR, strlen(CMD_TERMINAR));
+            return;
+        }
+
+        long atraso = ahora_ns() - hora_de(e->t_us);
+        if (velocidad != 0) agregar_muestra(&atrasos, atraso > 0 ? atraso : 0);
+        char linea[MAX_LINEA + 2];
+        memcpy(linea, e->comando, e->largo);
+        linea[e->largo] = '\n';
+        if (tipo == TIPO_OTRO && e->largo >= 5 && strncmp(e->comando, "JOIN:", 5) == 0) s->en_sala = 1;
+        if (tipo == TIPO_OTRO && e->largo == 5 && strncmp(e->comando, "LEAVE", 5) == 0) s->en_sala = 0;
+        s->siguiente++;
+        s->tipo_espera = tipo;
+        s->resincronizando = 0;
+        enviados++;
+        enviar(s, linea, e->largo + 1);
+        return;
+    }
+    // No quedan comandos: cerrar como en la traza
+    cerrar_sesion(s);
+}
+
+// Actualiza el estado de la sesión con una respuesta (línea de texto o trama)
+void ver_respuesta(sesion_t *s, uint8_t opcode, const char *texto) {
+    switch (opcode) {
+        case OP_STATE:    s->en_partida = 1; break;
+        case OP_GAMEOVER: s->en_partida = 0; break;
+        case OP_INFO:
+            if (strncmp(texto, "OK:JOIN:", 8) == 0) {
+                s->en_sala = 1;
+                s->en_partida = 0;
+            } else if (strncmp(texto, "OK:LEAVE", 8) == 0) {
+                s->en_sala = 0;
+            }
+            break;
+        case OP_ERROR:
+            if (strncmp(texto, "ERROR:Server", 12) == 0 || strncmp(texto, "ERROR:Timeout", 13) == 0) errores++;
+            break;
+        default:
+            break;
+    }
+    s->respondio = 1;
+}
+
+// Procesa las líneas y tramas completas del buffer. Devuelve 1 si no quedó nada a
+// medias (la respuesta llegó entera: el servidor manda cada una en un solo envío).
+int procesar_entrada(sesion_t *s) {
+    int ini = 0;
+    while (ini < s->entrada_len) {
+        if (s->binario) {
+            if (s->entrada_len - ini < (int)sizeof(cabecera_bin_t)) break;
+            cabecera_bin_t cab;
+            memcpy(&cab, s->entrada + ini, sizeof(cab));
+            int largo = ntohs(cab.largo);
+            if (s->entrada_len - ini < (int)sizeof(cab) + largo) break;
+            char texto[MAX_LINEA];
+            int copia = largo < MAX_LINEA - 1 ? largo : MAX_LINEA - 1;
+            memcpy(texto, s->entrada + ini + sizeof(cab), copia);
+            texto[copia] = '\0';
+            ver_respuesta(s, cab.opcode, texto);
+            ini += sizeof(cab) + largo;
+            continue;
+        }
+
+        char *nl = memchr(s->entrada + ini, '\n', s->entrada_len - ini);
+        if (!nl) break;
+        char linea[MAX_LINEA];
+        int len = nl - (s->entrada + ini) < MAX_LINEA - 1 ? nl - (s->entrada + ini) : MAX_LINEA - 1;
+        memcpy(linea, s->entrada + ini, len);
+        linea[len] = '\0';
+        ini = nl + 1 - s->entrada;
+
+        if (strncmp(linea, "BUSY:", 5) == 0) continue;  // sigue en la cola de espera
+        if (strcmp(linea, "OK:BIN") == 0) s->binario = 1;
+        uint8_t opcode = 0;
+        if (strncmp(linea, "STATE:", 6) == 0) opcode = OP_STATE;
+        else if (strncmp(linea, "GAMEOVER:", 9) == 0) opcode = OP_GAMEOVER;
+        else if (strncmp(linea, "ERROR", 5) == 0) opcode = OP_ERROR;
+        else if (strncmp(linea, "OK:", 3) == 0) opcode = OP_INFO;
+        ver_respuesta(s, opcode, linea);
+    }
+    s->entrada_len -= ini;
+    memmove(s->entrada, s->entrada + ini, s->entrada_len);
+    if (s->entrada_len == (int)sizeof(s->entrada)) s->entrada_len = 0;
+    return s->entrada_len == 0;
+}
+
+void atender_lectura(sesion_t *s) {
+    while (s->fase != FASE_TERMINADA) {
+        ssize_t n = recv(s->fd, s->entrada + s->entrada_len, sizeof(s->entrada) - s->entrada_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            // El servidor cerró: esperable tras un QUIT (o lo que en la captura
+            // terminaba con BYE); si no, es un error
+            int esperado = s->siguiente > 0 && s->siguiente == s->num_comandos;
+            if (!esperado) errores++;
+            if (s->fase == FASE_ESPERANDO) {
+                agregar_muestra(&latencias[s->tipo_espera], ahora_ns() - s->t_envio);
+            }
+            cerrar_sesion(s);
+            return;
+        }
+        s->entrada_len += n;
+        int completa = procesar_entrada(s);
+        if (!completa || !s->respondio) continue;
+
+        if (s->fase == FASE_ESPERA_INICIAL && s->en_partida) {
+            agregar_muestra(&latencias[TIPO_CONEXION], ahora_ns() - s->t_envio);
+            agendar_siguiente(s);
+        } else if (s->fase == FASE_ESPERANDO) {
+            if (s->resincronizando) {
+                s->resincronizando = 0;
+                enviar_siguiente(s);   // el PLAY que esperaba
+            } else {
+                agregar_muestra(&latencias[s->tipo_espera], ahora_ns() - s->t_envio);
+                agendar_siguiente(s);
+            }
+        }
+    }
+}
+
+void abrir_sesion(sesion_t *s) {
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd < 0) {
+        perror("socket");
+        errores++;
+        s->fase = FASE_TERMINADA;
+        return;
+    }
+    s->fase = FASE_CONECTANDO;
+    sesiones_vivas++;
+    s->t_envio = ahora_ns();
+    if (connect(s->fd, (struct sockaddr *)&dir, sizeof(dir)) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        errores++;
+        cerrar_sesion(s);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = s;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+}
+
+// Lo agendado para una sesión: conectarse, mandar el comando siguiente o cerrar
+void cumplir_cita(sesion_t *s) {
+    if (s->fase == FASE_PROGRAMADA) {
+        abrir_sesion(s);
+    } else if (s->fase == FASE_LISTA) {
+        enviar_siguiente(s);
+    }
+}
+
+// ======================= Resumen y comparación =======================
+void guardar_resumen(const char *ruta) {
+    FILE *f = fopen(ruta, "w");
+    if (!f) {
+        perror(ruta);
+        return;
+    }
+    fprintf(f, "# tipo n p50_ns p90_ns p99_ns\n");
+    for (int k = 0; k < NUM_TIPOS; k++) {
+        muestras_t *m = &latencias[k];
+        if (m->n == 0) continue;
+        fprintf(f, "%s %zu %ld %ld %ld\n", nombres_tipos[k], m->n,
+                percentil(m, 50), percentil(m, 90), percentil(m, 99));
+    }
+    fclose(f);
+    printf("Resumen guardado en %s\n", ruta);
+}
+
+// Compara contra un resumen anterior. Devuelve 1 si algún p99 empeoró más que el umbral.
+int comparar_resumen(const char *ruta, double umbral) {
+    FILE *f = fopen(ruta, "r");
+    if (!f) {
+        perror(ruta);
+        return 0;
+    }
+    printf("\n===== DIFERENCIA CONTRA %s =====\n", ruta);
+    int regresion = 0;
+    char linea[256];
+    while (fgets(linea, sizeof(linea), f)) {
+        char nombre[32];
+        size_t n;
+        long p50, p90, p99;
+        if (linea[0] == '#' || sscanf(linea, "%31s %zu %ld %ld %ld", nombre, &n, &p50, &p90, &p99) != 5) continue;
+        for (int k = 0; k < NUM_TIPOS; k++) {
+            muestras_t *m = &latencias[k];
+            if (strcmp(nombre, nombres_tipos[k]) != 0 || m->n == 0) continue;
+            long a50 = percentil(m, 50), a99 = percentil(m, 99);
+            double d50 = p50 ? 100.0 * (a50 - p50) / p50 : 0;
+            double d99 = p99 ? 100.0 * (a99 - p99) / p99 : 0;
+            int malo = umbral >= 0 && d99 > umbral && m->n >= MIN_MUESTRAS_COMPARACION;
+            printf("%-10s p50 %.1fus -> %.1fus (%+.1f%%)   p99 %.1fus -> %.1fus (%+.1f%%)%s\n",
+                   nombre, p50 / 1000.0, a50 / 1000.0, d50, p99 / 1000.0, a99 / 1000.0, d99,
+                   malo ? "   <-- REGRESIÓN" : "");
+            regresion |= malo;
+        }
+    }
+    fclose(f);
+    return regresion;
+}
+
+int main(int argc, char *argv[]) {
+    const char *ruta_resumen = NULL, *ruta_base = NULL;
+    double umbral = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v:o:b:u:")) != -1) {
+        switch (opt) {
+            case 'v':
+                velocidad = strcmp(optarg, "max") == 0 ? 0 : atof(optarg);
+                if (velocidad < 0 || (velocidad == 0 && strcmp(optarg, "max") != 0)) goto uso;
+                break;
+            case 'o': ruta_resumen = optarg; break;
+            case 'b': ruta_base = optarg; break;
+            case 'u': umbral = atof(optarg); break;
+            default:
+                goto uso;
+        }
+    }
+    if (argc - optind != 3) {
+uso:
+        fprintf(stderr, "Uso: %s <IP_Servidor> <Puerto> <traza> [-v velocidad|max] [-o resumen]\n"
+                        "          [-b resumen_base] [-u umbral_pct]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Hace falta un descriptor por conexión: subir el límite blando al máximo
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    memset(&dir, 0, sizeof(dir));
+    dir.sin_family = AF_INET;
+    dir.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &dir.sin_addr) <= 0) {
+        fprintf(stderr, "Dirección inválida: %s\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    sesion_t *sesiones;
+    int num_sesiones = cargar_traza(argv[optind + 2], &sesiones);
+    // La agenda despierta al bucle con un timerfd: epoll_wait() solo tiene resolución de
+    // ms y ese redondeo, sumado en cada comando de una sesión, la atrasaría
+    epfd = epoll_create1(0);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (num_sesiones < 0 || epfd < 0 || tfd < 0) {
+        perror("epoll_create1/timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev_timer;
+    ev_timer.events = EPOLLIN;
+    ev_timer.data.ptr = NULL;  // NULL identifica al timerfd
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev_timer);
+    long timer_armado = -1;
+    // La captura arranca con el servidor: el instante 0 es la entrada de la primera conexión
+    long comandos = 0, duracion_us = 0;
+    for (int i = 0; i < num_sesiones; i++) {
+        if (i == 0 || sesiones[i].t_inicio_us < origen_us) origen_us = sesiones[i].t_inicio_us;
+        comandos += sesiones[i].num_comandos;
+        long fin = sesiones[i].t_fin_us;
+        if (sesiones[i].num_comandos > 0 && sesiones[i].comandos[sesiones[i].num_comandos - 1].t_us > fin) {
+            fin = sesiones[i].comandos[sesiones[i].num_comandos - 1].t_us;
+        }
+        if (fin > duracion_us) duracion_us = fin;
+    }
+    printf("Replay: %d sesiones, %ld comandos, %.3f s de captura contra %s:%s, velocidad ",
+           num_sesiones, comandos, (duracion_us - origen_us) / 1e6, argv[optind], argv[optind + 1]);
+    if (velocidad == 0) printf("max\n");
+    else printf("%gx\n", velocidad);
+
+    t0 = ahora_ns();
+    for (int i = 0; i < num_sesiones; i++) {
+        sesiones[i].fase = FASE_PROGRAMADA;
+        agendar(&sesiones[i], hora_de(sesiones[i].t_inicio_us));
+    }
+
+    long inicio = ahora_ns();
+    long ultima_actividad = inicio;
+    struct epoll_event eventos[MAX_EVENTOS];
+    while (1) {
+        // Lo que ya venció de la agenda
+        long ahora = ahora_ns();
+        while (num_citas > 0 && agenda[0].t <= ahora) {
+            cita_t c = sacar_cita();
+            cumplir_cita(c.s);
+        }
+        if (sesiones_vivas == 0 && num_citas == 0) break;
+
+        if (num_citas > 0 && agenda[0].t != timer_armado) {
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = agenda[0].t / 1000000000L;
+            its.it_value.tv_nsec = agenda[0].t % 1000000000L;
+            timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+            timer_armado = agenda[0].t;
+        }
+        int n = epoll_wait(epfd, eventos, MAX_EVENTOS, num_citas > 0 ? -1 : INACTIVIDAD_MAX_MS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (n > 0 || num_citas > 0) {
+            ultima_actividad = ahora_ns();
+        } else if (ahora_ns() - ultima_actividad >= INACTIVIDAD_MAX_MS * 1000000L) {
+            printf("Sin actividad por %d ms: se abandonan %d sesiones.\n", INACTIVIDAD_MAX_MS, sesiones_vivas);
+            for (int i = 0; i < num_sesiones; i++) {
+                if (sesiones[i].fd >= 0) {
+                    errores++;
+                    cerrar_sesion(&sesiones[i]);
+                }
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            sesion_t *s = eventos[i].data.ptr;
+            if (s == NULL) {
+                uint64_t vencimientos;
+                if (read(tfd, &vencimientos, sizeof(vencimientos)) < 0) {
+                    // EAGAIN: se rearmó para más adelante antes de leerlo
+                }
+                timer_armado = -1;
+                continue;
+            }
+
+            if (s->fase == FASE_CONECTANDO) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    errores++;
+                    cerrar_sesion(s);
+                    continue;
+                }
+                s->fase = FASE_ESPERA_INICIAL;
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.ptr = s;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+            }
+
+            if (s->fase != FASE_TERMINADA &&
+                (eventos[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                atender_lectura(s);
+            }
+        }
+    }
+    double segundos = (ahora_ns() - inicio) / 1e9;
+
+    printf("\n===== RESULTADOS =====\n");
+    printf("Tiempo total:          %.3f s (captura: %.3f s)\n", segundos, (duracion_us - origen_us) / 1e6);
+    printf("Comandos enviados:     %ld (%ld omitidos, %ld resincronizaciones)\n",
+           enviados, omitidos, resincronizaciones);
+    printf("Comandos/seg:          %.1f\n", enviados / segundos);
+    printf("Errores:               %ld\n", errores);
+    if (velocidad != 0) imprimir_percentiles("Atraso vs. traza:", &atrasos);
+    for (int k = 0; k < NUM_TIPOS; k++) {
+        char nombre[32];
+        snprintf(nombre, sizeof(nombre), "%s:", nombres_tipos[k]);
+        imprimir_percentiles(nombre, &latencias[k]);
+    }
+
+    if (ruta_resumen) guardar_resumen(ruta_resumen);
+    int regresion = ruta_base ? comparar_resumen(ruta_base, umbral) : 0;
+
+    free(sesiones);
+    close(tfd);
+    close(epfd);
+    return regresion ? 2 : 0;
+}
@@ -3,17 +3,82 @@
  *
  * Servidor de Ahorcado con Threads y Sockets TCP.
  *
- * - Acepta hasta MAX_CLIENTES concurrentes; el resto espera en la cola de listen().
+ * - Modelo orientado a eventos: un pool fijo de hilos de eventos (opción -t, por
+ *   defecto uno por núcleo), cada uno con su propio socket de escucha en el puerto con
+ *   SO_REUSEPORT: el kernel reparte las conexiones entrantes entre ellos y no hay un
+ *   único accept() que las serialice (backlog configurable con -b). Cada hilo de eventos
+ *   atiende muchas conexiones con un epoll en modo edge-triggered y sockets no
+ *   bloqueantes; el estado de cada partida vive en una estructura por conexión
+ *   (conexion_t), así que un jugador inactivo no ocupa un hilo ni su stack.
+ * - Acepta hasta max_clientes concurrentes (opción -c); los lugares se reservan con un
+ *   CAS sobre un contador compartido. Quien llega sin lugar pasa al hilo principal,
+ *   queda en una cola de pendientes, recibe enseguida "BUSY:<posición>" y entra en
+ *   orden en cuanto se libera un lugar (un eventfd despierta al hilo principal, sin
+ *   esperas con sleep()). El principal los entrega al pool por una cola MPMC acotada y
+ *   un eventfd registrado con EPOLLEXCLUSIVE, que despierta a un solo hilo por conexión.
  * - Imprime mensajes de información al arrancar (IP, puerto, max clientes, etc.).
  * - Refresca cada INTERVALO_REFRESCO segundos el estado de clientes activos y
  *   las estadísticas globales (partidas jugadas, ganadas, perdidas, % ganadas).
- * - Maneja SIGINT para cierre limpio: deja de aceptar, espera a que todos los clientes
- *   se desconecten y luego cierra.
+ * - Cierre limpio con SIGINT/SIGTERM: las señales se bloquean en todos los hilos y se
+ *   leen con un signalfd en el bucle principal (sin código en un manejador). Deja de
+ *   aceptar, despierta a todos los hilos de eventos con un eventfd y les da hasta
+ *   PLAZO_CIERRE_MS (opción -p) para que terminen las partidas en curso; luego los
+ *   une con pthread_join. Sin partidas en curso, el cierre tarda milisegundos.
+ * - Timeouts por conexión para que los lugares queden para quienes juegan: línea a
+ *   medio llegar (lectura), sin comandos (inactividad, opción -i) y duración total de
+ *   la partida. Cada hilo de eventos lleva una rueda de timers (sin un timer por
+ *   conexión); las conexiones vencidas se expulsan y se cuentan en las métricas.
+ * - Queda corriendo aunque se vayan todos los clientes (conserva estadísticas y el
+ *   diccionario cargado) hasta SIGINT/SIGTERM. Con -x, en cambio, se cierra solo
+ *   cuando no quedan clientes tras haber atendido al menos uno.
  * - Usa SO_REUSEADDR para poder reiniciar inmediatamente en el mismo puerto.
  * - Permite "jugar otra partida" (PLAY) o "salir" (QUIT) tras finalizar una partida.
  * - Acumula y envía siempre la lista de letras usadas para que el cliente la muestre.
  * - Si el cliente se desconecta o envía QUIT durante la partida, la cuenta como perdida.
  *
+ * - Publica métricas en texto (formato Prometheus) en 127.0.0.1:PUERTO_METRICAS (opción
+ *   -m): conexiones, partidas, bytes, profundidad de las colas de admisión, histogramas
+ *   de latencia por comando y sus percentiles. Ej: curl -s http://127.0.0.1:8081/metrics
+ *   Lo atiende un hilo propio, así un colector lento no demora la admisión.
+ * - Latencia de cada comando: desde el recv() que completa su línea hasta que el último
+ *   byte de la respuesta entra al socket. Cada hilo de eventos la suma a histogramas
+ *   propios estilo HDR (SUBCUBETAS cubetas lineales por potencia de 2), que se juntan
+ *   solo al leerlos. Las solicitudes que tardan más de UMBRAL_LENTO_MS (opción -l) se
+ *   guardan en un anillo por hilo con hora, conexión, comando y cuánto fue armar la
+ *   respuesta y cuánto enviarla; se vuelcan con SIGUSR1 (en la salida del servidor) o
+ *   con curl -s http://127.0.0.1:8081/lentas.
+ * - Salida con buffer circular por conexión: las respuestas a todos los comandos de
+ *   una misma lectura se acumulan y salen juntas en un solo sendmsg() (vectorizado si
+ *   el buffer da la vuelta), con TCP_NODELAY para que Nagle no las retenga.
+ * - Jugadores: "HELLO:<nombre>" identifica la conexión y sus partidas se suman a un
+ *   registro por nombre (tabla hash con locks por franjas). "TOP" devuelve el ranking
+ *   de los TOP_K con más partidas ganadas, que se mantiene ordenado a cada victoria
+ *   (leerlo es O(k), sin ordenar nada). Con -j, los registros persisten: cada cambio
+ *   se agrega a un log (archivo) y cada INTERVALO_SNAPSHOT segundos se escribe un
+ *   snapshot completo (archivo.snap) y se vacía el log.
+ * - Salas: "JOIN:<sala>" suma la conexión a una sala donde todos adivinan la misma
+ *   palabra. Cada cambio de la partida se arma una sola vez (en texto y en binario) en
+ *   un buffer con contador de referencias; cada miembro lo encola por referencia en su
+ *   salida, sin copiarlo ni formatearlo de nuevo. El hilo que juega avisa con un eventfd
+ *   a los hilos de eventos que tienen miembros de la sala y cada uno entrega a los suyos.
+ *   Cuando la partida de la sala termina, el resultado se suma al registro de cada
+ *   miembro identificado con HELLO; irse antes (QUIT, LEAVE) no cuenta como perdida.
+ * - Captura de tráfico (opción -r): graba en un archivo binario compacto (ver traza.h)
+ *   cuándo entra cada conexión, cada línea que manda y cuándo se cierra, para
+ *   reproducir después el mismo patrón de carga con replay.c. Cada hilo de eventos
+ *   junta sus registros en un buffer propio y los escribe en bloques.
+ * - Respuestas en texto por defecto; un cliente puede negociar tramas binarias
+ *   compactas enviando "BIN" (ver protocolo.h).
+ * - Palabras: la lista interna o un diccionario externo (opción -f, una palabra a-z por
+ *   línea) mapeado con mmap y compartido por todos los hilos. Al arrancar se arma un
+ *   índice de desplazamientos agrupado por dificultad (largo de la palabra, opción -d).
+ *   Cada hilo de eventos sortea con su propio generador xorshift, sin rand().
+ *
+ * Uso: ./servidor [-t hilos_de_eventos] [-c max_clientes] [-m puerto_metricas]
+ *                 [-f diccionario] [-d facil|medio|dificil|todos] [-p plazo_cierre_ms]
+ *                 [-i inactividad_seg] [-x] [-b backlog] [-j archivo_jugadores]
+ *                 [-r archivo_traza] [-l umbral_lento_ms]
+ *
  * Autor: Tú mismo
  * Fecha: 2025
  */
@@ -23,76 +88,441 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include <time.h>
+#include <endian.h>
+
+#include "protocolo.h"
+#include "traza.h"
 
 // ======================= Configuración ========================
 #define PUERTO 8080
-#define MAX_CLIENTES 5
+#define PUERTO_METRICAS 8081  // Solo escucha en 127.0.0.1 (opción -m, 0 = desactivado)
+#define MAX_CLIENTES 5      // Clientes concurrentes por defecto (opción -c)
+#define MAX_PENDIENTES 1024 // Conexiones que pueden esperar lugar en la cola
+#define BACKLOG 1024        // listen() de cada socket de escucha (opción -b; el kernel
+                            // lo limita a net.core.somaxconn)
 #define MAX_PALABRA 32      // Longitud máxima de cada palabra
 #define MAX_INTENTOS 6      // Intentos máximos para cada partida
 
+// Máximo de hilos de eventos (opción -t; por defecto, uno por núcleo)
+#define MAX_HILOS_EVENTOS 64
+
+// Capacidad de la cola de conexiones admitidas (potencia de 2)
+#define CAPACIDAD_COLA_CONEXIONES 1024
+
+// Histogramas de latencia por comando, estilo HDR: las latencias (ns) menores a
+// SUBCUBETAS van cada una en su cubeta y desde ahí cada potencia de 2 se parte en
+// SUBCUBETAS cubetas iguales (error relativo menor a 1/SUBCUBETAS), hasta 2^MAX_EXP_LATENCIA
+// (~69 s); lo que pasa de ahí va a la última cubeta
+#define BITS_SUBCUBETA 3
+#define SUBCUBETAS (1 << BITS_SUBCUBETA)
+#define MAX_EXP_LATENCIA 36
+#define NUM_CUBETAS ((MAX_EXP_LATENCIA - BITS_SUBCUBETA + 1) * SUBCUBETAS)
+// Límites (le = 2^k ns) del histograma que se publica en /metrics
+#define EXP_METRICAS_MIN 10
+#define EXP_METRICAS_MAX 35
+#define MAX_METRICAS 32768
+
+// Solicitudes lentas: umbral por defecto (opción -l), cuántas guarda cada hilo de
+// eventos (potencia de 2) y comandos de una conexión que pueden estar esperando que su
+// respuesta termine de salir
+#define UMBRAL_LENTO_MS 20
+#define MAX_LENTAS 64
+#define MAX_MEDIDAS 16
+#define LARGO_COMANDO_LENTO 32
+
+#define CACHE_LINE 64
+#define ALINEADO __attribute__((aligned(CACHE_LINE)))
+
+// Eventos que procesa cada epoll_wait()
+#define MAX_EVENTOS 64
+
+// Tiempo (ms) que se les da a las partidas en curso para terminar al cerrar (opción -p)
+#define PLAZO_CIERRE_MS 2000
+
+// Bytes pendientes de envío por conexión antes de considerarla colgada (potencia de 2)
+#define MAX_SALIDA 4096
+
+// Buffer circular de entrada por conexión (potencia de 2) y largo máximo de un comando
+#define TAM_ENTRADA 256
+#define MAX_LINEA 128
+
+// Timeouts por conexión (ms): una línea a medio llegar, sin comandos completos
+// (opción -i, en segundos) y duración total de una partida
+#define TIMEOUT_LECTURA_MS 10000
+#define TIMEOUT_INACTIVIDAD_MS 60000
+#define TIMEOUT_PARTIDA_MS 600000
+
+// Rueda de timers de cada hilo de eventos: NUM_RANURAS ranuras (potencia de 2) de
+// RESOLUCION_RUEDA_MS cada una
+#define NUM_RANURAS 256
+#define RESOLUCION_RUEDA_MS 250
+
 // Intervalo (en segundos) para refrescar la información en pantalla
 #define INTERVALO_REFRESCO 10
 
-// ==================== Variables globales ======================
-int clientes_activos         = 0;
-int total_partidas_jugadas   = 0;
-int total_partidas_ganadas   = 0;
-int total_partidas_perdidas  = 0;
-pthread_mutex_t mutex_contador = PTHREAD_MUTEX_INITIALIZER;
+// Registro de jugadores: largo máximo del nombre, cubetas de la tabla hash (potencia
+// de 2), locks que las reparten, tamaño del ranking y períodos (s) de persistencia
+#define MAX_NOMBRE 16
+#define TAM_TABLA_JUGADORES 16384
+#define NUM_FRANJAS 64
+#define TOP_K 10
+#define INTERVALO_REGISTRO 1
+#define INTERVALO_SNAPSHOT 60
+
+// Salas: difusiones que guarda cada sala para los miembros que van atrasados, mensajes
+// compartidos que una conexión puede tener encolados (potencia de 2), iovec por
+// sendmsg() y cubetas de la tabla de salas (potencia de 2)
+#define HISTORIAL_SALA 32
+#define MAX_REFS_SALIDA 64
+#define MAX_IOV 64
+#define TAM_TABLA_SALAS 1024
+
+// Captura (opción -r): buffer de registros de cada hilo de eventos y cada cuánto (ms)
+// se escribe aunque no se haya llenado
+#define TAM_BUF_TRAZA 65536
+#define INTERVALO_TRAZA_MS 1000
+
+// ==================== Estado por conexión =====================
+// La conexión está en una partida o esperando PLAY/QUIT tras un GAMEOVER
+typedef enum {
+    CONN_JUGANDO,
+    CONN_FIN_PARTIDA
+} estado_conexion_t;
+
+// Estado de una partida con máscaras de bits: cada jugada es un par de operaciones
+// de bits en vez de recorrer cadenas. Las letras van de 'a' (bit 0) a 'z' (bit 25)
+// y las posiciones de la palabra, de 0 a MAX_PALABRA-1.
+#define LETRA_BIT(l) (1u << ((l) - 'a'))
 
-// Para asignar un ID único a cada conexión
-int siguiente_id = 0;
+typedef struct {
+    const char *palabra;              // palabra real (no necesariamente terminada en '\0')
+    uint32_t posiciones[26];          // posiciones de cada letra en la palabra
+    uint32_t usadas;                  // letras ya probadas
+    uint32_t reveladas;               // posiciones ya descubiertas
+    uint8_t  len;
+    uint8_t  ocultas;                 // posiciones sin descubrir: 0 = ganó
+    int8_t   intentos;
+} partida_t;
+
+// Registro de un jugador. Los contadores solo crecen; se escriben con el lock de la
+// franja de su cubeta y se leen con cargas atómicas (ranking, métricas).
+typedef struct jugador {
+    char nombre[MAX_NOMBRE + 1];
+    long ganadas;
+    long perdidas;
+    int pos_top;              // posición en el ranking, -1 si no está (con mutex_top)
+    struct jugador *sig;      // siguiente en la cubeta
+} jugador_t;
+
+// Mensaje armado una sola vez y compartido por todas las conexiones que lo envían.
+// Se libera cuando la última suelta su referencia (contador atómico).
+typedef struct {
+    int refs;
+    uint32_t len;
+    char datos[];
+} mensaje_t;
 
-// Guardamos los pthread_t de hilos activos para monitoreo
-pthread_t lista_hilos[MAX_CLIENTES];
-pthread_t hilo_refresco;  // Guardamos el ID del hilo de refresco
+// Mensaje compartido en la cola de salida: va después de los bytes del buffer circular
+// anteriores a 'pos' (el salida_fin al encolarlo), así se respeta el orden de envío
+typedef struct {
+    mensaje_t *m;
+    unsigned int pos;
+} ref_salida_t;
 
-// Array para guardar los sockets de clientes activos
-int sockets_clientes[MAX_CLIENTES];
-pthread_mutex_t mutex_sockets = PTHREAD_MUTEX_INITIALIZER;
+struct sala;
 
-// Socket del servidor (global para poder cerrarlo en el manejador de señales)
-int server_socket_fd = -1;
+// Comando ya respondido cuya respuesta todavía no terminó de salir: su latencia se
+// registra cuando el buffer de salida queda vacío
+typedef struct {
+    uint8_t tipo;                         // tipo_comando_t
+    long llegada;                         // ahora_ns() del recv() que completó la línea
+    long armada;                          // ahora_ns() con la respuesta ya en la salida
+    char comando[LARGO_COMANDO_LENTO];
+} medida_t;
+
+typedef struct conexion {
+    int fd;
+    int id;
+    estado_conexion_t estado;
+    int binario;              // respuestas en tramas binarias (protocolo.h) en vez de texto
+    jugador_t *jugador;       // NULL hasta que el cliente manda HELLO
+
+    partida_t partida;        // partida en curso
+
+    // Bytes recibidos que aún no forman una línea completa. Los índices avanzan
+    // libremente y se reducen con & (TAM_ENTRADA - 1); 'revisado' evita volver a
+    // buscar el '\n' en bytes ya mirados.
+    char entrada[TAM_ENTRADA];
+    unsigned int entrada_ini, entrada_fin, entrada_revisado;
+    int descartando;          // se está salteando el resto de una línea demasiado larga
+
+    // Respuestas todavía no enviadas: las de la tanda de comandos en curso y lo que el
+    // socket no aceptó (se reintenta con EPOLLOUT). Buffer circular como 'entrada'.
+    char salida[MAX_SALIDA];
+    unsigned int salida_ini, salida_fin;
+    int esperando_salida;     // EPOLLOUT está pedido en el epoll
+
+    // Mensajes compartidos (difusiones de la sala) todavía no enviados
+    ref_salida_t refs[MAX_REFS_SALIDA];
+    unsigned int refs_ini, refs_fin;
+    uint32_t ref_enviado;     // bytes ya enviados del primero
+
+    // Sala en la que juega (NULL: partida propia) y difusiones de la sala ya encoladas
+    struct sala *sala;
+    unsigned long sala_visto;
+    struct conexion *sala_ant, *sala_sig;  // miembros de salas del mismo hilo de eventos
+
+    long llegada;             // ahora_ns() del último recv() con datos
+    medida_t medidas[MAX_MEDIDAS];
+    int num_medidas;
+
+    // Timeouts (ms de CLOCK_MONOTONIC). 'vence' es el más próximo de los tres y
+    // decide en qué ranura de la rueda está la conexión (-1: en ninguna).
+    long ultima_actividad;    // último comando completo
+    long inicio_linea;        // llegada del primer byte de una línea incompleta (0: no hay)
+    long inicio_partida;
+    long vence;
+    int ranura;
+    struct conexion *rueda_ant, *rueda_sig;
+
+    struct conexion *ant, *sig;  // lista de conexiones del hilo de eventos
+    int cerrada;              // ya se cerró; se libera al terminar la tanda de eventos
+} conexion_t;
+
+// Sala: una partida compartida. La partida, el historial y los contadores de miembros
+// se tocan con 'mutex'; 'seq' se escribe con el mutex y se lee también sin él (carga
+// atómica) para ver si hay algo nuevo antes de tomarlo.
+typedef struct sala {
+    char nombre[MAX_NOMBRE + 1];
+    pthread_mutex_t mutex;
+    partida_t partida;
+    int terminada;                          // GAMEOVER: espera un PLAY
+    int num_miembros;
+    int miembros_hilo[MAX_HILOS_EVENTOS];   // miembros de cada hilo de eventos
+    unsigned long seq;                      // difusiones hechas
+    mensaje_t *historial[HISTORIAL_SALA][2];  // la difusión k va en k % HISTORIAL_SALA:
+                                              // [0] en texto, [1] en binario
+    int8_t resultado[HISTORIAL_SALA];         // 1/-1 si la difusión k cerró la partida
+                                              // ganada/perdida, 0 si no
+    struct sala *sig;                       // siguiente en la cubeta
+} sala_t;
+
+// Cola MPMC acotada (esquema de Vyukov): cada celda lleva un número de secuencia que
+// dice si está libre para el productor (== pos) o lista para el consumidor (== pos+1).
+// Productores y consumidores solo compiten por su propio índice con un CAS.
+typedef struct {
+    size_t secuencia;
+    int fd;
+    int id;
+} celda_conexion_t;
 
-// Flag para indicarle al servidor que debe cerrar
-volatile sig_atomic_t shutdown_server = 0;
+typedef struct {
+    celda_conexion_t celdas[CAPACIDAD_COLA_CONEXIONES];
+    size_t pos_encolar ALINEADO;
+    size_t pos_desencolar ALINEADO;
+} cola_conexiones_t;
+
+// Estadísticas de un hilo de eventos. Solo las escribe su hilo (sin locks ni
+// instrucciones lock: carga + store atómicos relajados) y ocupan su propia línea de
+// caché, así que los hilos no se pisan. Quien las lee suma las de todos los hilos.
+typedef enum {
+    CMD_TRY,
+    CMD_TRYN,
+    CMD_PLAY,
+    CMD_QUIT,
+    CMD_OTRO,
+    NUM_COMANDOS
+} tipo_comando_t;
+
+const char *nombres_comandos[NUM_COMANDOS] = { "TRY", "TRYN", "PLAY", "QUIT", "OTRO" };
+
+// Motivos por los que se expulsa una conexión vencida
+typedef enum {
+    TIMEOUT_LECTURA,
+    TIMEOUT_INACTIVIDAD,
+    TIMEOUT_PARTIDA,
+    NUM_TIMEOUTS
+} motivo_timeout_t;
+
+const char *nombres_timeouts[NUM_TIMEOUTS] = { "lectura", "inactividad", "partida" };
+
+// Solicitud lenta guardada en el anillo de su hilo. La escribe solo ese hilo; 'seq'
+// queda impar mientras la escribe, así quien la lee de otro hilo descarta una copia
+// a medio escribir (seqlock, sin bloquear al hilo de eventos).
+typedef struct {
+    unsigned int seq;
+    int conexion;
+    tipo_comando_t tipo;
+    long hora_ns;             // CLOCK_REALTIME de la llegada
+    long total_ns;            // recv() -> respuesta enviada
+    long proceso_ns;          // recv() -> respuesta armada (el resto es esperar al socket)
+    char comando[LARGO_COMANDO_LENTO];
+} solicitud_lenta_t;
+
+// Copia de una solicitud lenta para el volcado, con el hilo de eventos que la guardó
+typedef struct {
+    solicitud_lenta_t s;
+    int hilo;
+} copia_lenta_t;
 
-// ===================== Manejador SIGINT =======================
-void handle_sigint(int sig) {
-    printf("\nRecibido SIGINT (Ctrl+C). Iniciando cierre del servidor...\n");
-    fflush(stdout);
-    shutdown_server = 1;
-    
-    // Notificar a todos los clientes activos
-    pthread_mutex_lock(&mutex_sockets);
-    for (int i = 0; i < MAX_CLIENTES; i++) {
-        if (sockets_clientes[i] > 0) {
-            send(sockets_clientes[i], "ERROR:Server shutting down\n", 26, 0);
-            close(sockets_clientes[i]);  // Cerrar socket del cliente
-            sockets_clientes[i] = 0;
-        }
-    }
-    pthread_mutex_unlock(&mutex_sockets);
+typedef struct {
+    long partidas_jugadas;
+    long partidas_ganadas;
+    long partidas_perdidas;
+    long conexiones_cerradas;
+    long bytes_recibidos;
+    long bytes_enviados;
+    long expulsadas[NUM_TIMEOUTS];  // conexiones cerradas por timeout, por motivo
+    long difusiones;                // cambios de partidas de sala armados (una vez cada uno)
+    long entregas;                  // difusiones encoladas a un miembro
+
+    // Latencia de cada comando (recv() -> respuesta enviada), ver cubeta_latencia()
+    long latencia_cubetas[NUM_COMANDOS][NUM_CUBETAS];
+    long latencia_suma_ns[NUM_COMANDOS];
+    long lentas;                    // solicitudes por encima del umbral
+} ALINEADO estadisticas_t;
+
+// Un hilo de eventos con su epoll, sus conexiones y sus estadísticas
+typedef struct {
+    estadisticas_t stats;
+    int id;
+    pthread_t hilo;
+    int epfd;
+    int escucha_fd;                  // socket de escucha propio (SO_REUSEPORT)
+    conexion_t *conexiones;
+    int num_conexiones;
+    conexion_t *cerradas;            // cerradas en la tanda en curso (enlazadas por 'sig')
+    uint64_t semilla;                // estado del xorshift64* propio del hilo
+    int cerrando;                    // recibió el aviso de cierre: no toma conexiones nuevas
+    long limite_cierre;              // ahora_ns() en el que se cortan las partidas en curso
+    conexion_t *rueda[NUM_RANURAS];  // rueda de timers de sus conexiones
+    long rueda_ms;                   // inicio de la ranura que toca revisar
+    int evfd_salas;                  // avisa que hay difusiones para sus miembros de salas
+    conexion_t *miembros_sala;
+    char *traza;                     // registros de captura sin escribir (con -r)
+    size_t traza_len;
+    long traza_volcada_ms;
+    solicitud_lenta_t lentas[MAX_LENTAS];  // anillo de las últimas solicitudes lentas
+    unsigned int proxima_lenta;
+} ALINEADO hilo_eventos_t;
 
-    // Cerrar el socket del servidor para interrumpir accept()
-    if (server_socket_fd != -1) {
-        close(server_socket_fd);
-    }
+// ==================== Variables globales ======================
+// Conexiones admitidas, por el hilo principal o por los hilos de eventos (ver
+// reservar_cupo()). Los clientes activos son admitidas menos las cerradas.
+long conexiones_admitidas = 0;
 
-    // Cancelar el hilo de refresco
-    pthread_cancel(hilo_refresco);
-}
+// Para asignar un ID único a cada conexión (se incrementa con una suma atómica)
+int siguiente_id = 0;
+int backlog = BACKLOG;
+
+// Opción -l: desde cuánto una solicitud se guarda como lenta
+long umbral_lento_ns = UMBRAL_LENTO_MS * 1000000L;
+
+int max_clientes = MAX_CLIENTES;
+
+// Cola FIFO de conexiones aceptadas que esperan lugar (solo la usa el hilo principal;
+// los hilos de eventos leen num_pendientes para no adelantarse a quien ya espera).
+// Un fd en -1 marca a un pendiente que se desconectó antes de entrar.
+int pendientes[MAX_PENDIENTES];
+int pendientes_ini = 0, pendientes_fin = 0;
+int num_pendientes = 0;
+
+// Conexiones que un hilo de eventos aceptó sin lugar libre, camino de la cola de
+// pendientes (el hilo avisa al principal con evfd_admision)
+cola_conexiones_t cola_espera;
+
+// eventfd con el que los hilos de eventos avisan al principal que se liberó un lugar
+int evfd_admision = -1;
+
+// Hilos de eventos que atienden a los clientes
+hilo_eventos_t hilos_eventos[MAX_HILOS_EVENTOS];
+int num_hilos_eventos = 0;
+
+// Conexiones admitidas que esperan a un hilo de eventos, y el eventfd (en modo
+// semáforo: una lectura = una conexión) que despierta a uno solo de ellos
+cola_conexiones_t cola_conexiones;
+int evfd_conexiones = -1;
+
+// eventfd de cierre: registrado en todos los hilos de eventos (sin EPOLLEXCLUSIVE) y
+// nunca leído, así una sola escritura los despierta a todos
+int evfd_cierre = -1;
+#define MARCA_CIERRE ((void *)&evfd_cierre)
+
+// Marca del socket de escucha de cada hilo en su epoll
+#define MARCA_ESCUCHA(h) ((void *)&(h)->escucha_fd)
+
+// Marca del eventfd de difusiones de salas de cada hilo en su epoll
+#define MARCA_SALAS(h) ((void *)&(h)->evfd_salas)
+int plazo_cierre_ms = PLAZO_CIERRE_MS;
+long timeout_inactividad_ms = TIMEOUT_INACTIVIDAD_MS;
+
+// Opción -x: cerrar cuando no quedan clientes (por defecto el servidor sigue corriendo)
+int salir_sin_clientes = 0;
+
+// Hilos de refresco y de persistencia: esperan en la variable de condición para que el
+// cierre los despierte enseguida en vez de cancelarlos a mitad de un sleep()
+pthread_t hilo_refresco;
+pthread_mutex_t mutex_refresco = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_refresco;
+
+// Flag de cierre: lo escribe el hilo principal (con mutex_refresco tomado)
+int shutdown_server = 0;
+
+// Registro de jugadores: tabla hash encadenada con NUM_FRANJAS locks (la cubeta i usa
+// el lock i % NUM_FRANJAS), así dos jugadores rara vez compiten por el mismo
+jugador_t *tabla_jugadores[TAM_TABLA_JUGADORES];
+pthread_mutex_t franjas_jugadores[NUM_FRANJAS];
+long num_jugadores = 0;
+
+// Ranking: los TOP_K con más partidas ganadas, de mayor a menor. Como las ganadas solo
+// crecen, alcanza con acomodar al que acaba de ganar.
+jugador_t *top[TOP_K];
+int num_top = 0;
+pthread_mutex_t mutex_top = PTHREAD_MUTEX_INITIALIZER;
+
+// Persistencia (opción -j): cambios pendientes de escribir en el log. Cada línea es
+// "nombre ganadas perdidas" con los totales, así que releerlas dos veces no cambia nada.
+const char *ruta_jugadores = NULL;
+int registro_fd = -1;
+char *registro_buf = NULL;
+size_t registro_len = 0, registro_cap = 0;
+pthread_mutex_t mutex_registro = PTHREAD_MUTEX_INITIALIZER;
+pthread_t hilo_persistencia;
+
+// Hilo de métricas (opción -m): atiende el socket de métricas fuera del bucle de admisión
+pthread_t hilo_metricas;
+
+// Salas abiertas: tabla hash por nombre. Orden de locks: mutex_salas y después el de
+// la sala. Una sala se crea con su primer miembro y se libera cuando se va el último.
+sala_t *tabla_salas[TAM_TABLA_SALAS];
+pthread_mutex_t mutex_salas = PTHREAD_MUTEX_INITIALIZER;
+long num_salas = 0;
+
+// Captura de tráfico (opción -r): archivo abierto con O_APPEND, que cada hilo de
+// eventos escribe en bloques enteros, y el instante de referencia de los registros
+const char *ruta_traza = NULL;
+int traza_fd = -1;
+long inicio_traza_ns = 0;
 
 // ======================= Palabras Ahorcado =====================
+// Lista interna, usada si no se indica un diccionario con -f
 const char *lista_palabras[] = {
     "programacion",
     "linux",
@@ -105,500 +535,2633 @@ const char *lista_palabras[] = {
 };
 const int num_palabras = sizeof(lista_palabras) / sizeof(lista_palabras[0]);
 
-// Devuelve un índice aleatorio entre 0 y num_palabras-1
-int palabra_aleatoria() {
-    return rand() % num_palabras;
+// Niveles de dificultad según el largo de la palabra
+typedef enum {
+    NIVEL_FACIL,     // hasta 5 letras
+    NIVEL_MEDIO,     // de 6 a 8 letras
+    NIVEL_DIFICIL,   // 9 letras o más
+    NUM_NIVELES,
+    NIVEL_TODOS = NUM_NIVELES
+} nivel_t;
+
+const char *nombres_niveles[] = { "facil", "medio", "dificil", "todos" };
+
+// Entrada del índice: dónde empieza la palabra dentro del archivo y su largo
+typedef struct {
+    uint32_t offset;
+    uint8_t  len;
+} entrada_palabra_t;
+
+// Diccionario de solo lectura, compartido por todos los hilos sin locks
+typedef struct {
+    const char *datos;                       // archivo mapeado (o la lista interna)
+    size_t tam;
+    entrada_palabra_t *indice[NUM_NIVELES];
+    size_t cantidad[NUM_NIVELES];
+    size_t capacidad[NUM_NIVELES];
+} diccionario_t;
+
+diccionario_t diccionario;
+nivel_t nivel_elegido = NIVEL_TODOS;
+
+nivel_t nivel_de_largo(int len) {
+    if (len <= 5) return NIVEL_FACIL;
+    if (len <= 8) return NIVEL_MEDIO;
+    return NIVEL_DIFICIL;
 }
 
-// ========== Función para enviar estado al cliente (UN SOLO send()) ==========
-void enviar_estado(int client_fd,
-                   const char *estado_palabra,
-                   int intentos_restantes,
-                   const char *letras_usadas,
-                   const char *mensaje_extra)
-{
-    char buffer[512] = {0};
+int agregar_al_indice(diccionario_t *d, uint32_t offset, int len) {
+    nivel_t nv = nivel_de_largo(len);
+    if (d->cantidad[nv] == d->capacidad[nv]) {
+        size_t nueva = d->capacidad[nv] ? d->capacidad[nv] * 2 : 1024;
+        entrada_palabra_t *tmp = realloc(d->indice[nv], nueva * sizeof(entrada_palabra_t));
+        if (!tmp) return -1;
+        d->indice[nv] = tmp;
+        d->capacidad[nv] = nueva;
+    }
+    d->indice[nv][d->cantidad[nv]].offset = offset;
+    d->indice[nv][d->cantidad[nv]].len = len;
+    d->cantidad[nv]++;
+    return 0;
+}
 
-    // Construir todo en un solo buffer:
-    // Primera línea: STATE:palabra|intentos|letras
-    int n = snprintf(buffer, sizeof(buffer),
-                     "STATE:%s|%d|%s\n",
-                     estado_palabra, intentos_restantes, letras_usadas);
+// Recorre el texto una sola vez y arma el índice. Se saltean las líneas vacías, las
+// que tienen algo fuera de a-z y las más largas que MAX_PALABRA. Acepta fin "\r\n".
+int indexar_diccionario(diccionario_t *d) {
+    const char *p = d->datos;
+    const char *fin = d->datos + d->tam;
+    while (p < fin) {
+        const char *nl = memchr(p, '\n', fin - p);
+        const char *fin_linea = nl ? nl : fin;
+        int len = fin_linea - p;
+        if (len > 0 && p[len - 1] == '\r') len--;
+
+        int valida = len > 0 && len <= MAX_PALABRA;
+        for (int i = 0; valida && i < len; i++) {
+            if (p[i] < 'a' || p[i] > 'z') valida = 0;
+        }
+        if (valida && agregar_al_indice(d, p - d->datos, len) < 0) {
+            perror("realloc indice");
+            return -1;
+        }
+        p = fin_linea + 1;
+    }
+    return 0;
+}
 
-    // Segunda línea: mensaje extra (WIN/LOSE o "¡Acierto!" / "Letra incorrecta")
-    if (mensaje_extra && strlen(mensaje_extra) > 0) {
-        snprintf(buffer + n, sizeof(buffer) - n, "%s\n", mensaje_extra);
+// Mapea el archivo de palabras (o arma el texto a partir de la lista interna)
+int cargar_diccionario(diccionario_t *d, const char *ruta) {
+    memset(d, 0, sizeof(*d));
+
+    if (ruta == NULL) {
+        size_t tam = 0;
+        for (int i = 0; i < num_palabras; i++) tam += strlen(lista_palabras[i]) + 1;
+        char *texto = malloc(tam + 1);  // + el '\0' que deja el último sprintf
+        if (!texto) return -1;
+        size_t n = 0;
+        for (int i = 0; i < num_palabras; i++) {
+            n += sprintf(texto + n, "%s\n", lista_palabras[i]);
+        }
+        d->datos = texto;
+        d->tam = tam;
+        return indexar_diccionario(d);
     }
 
-    // Enviar TODO de golpe
-    send(client_fd, buffer, strlen(buffer), 0);
+    int fd = open(ruta, O_RDONLY);
+    if (fd < 0) {
+        perror("open diccionario");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0 || st.st_size > UINT32_MAX) {
+        fprintf(stderr, "Diccionario vacío o demasiado grande: %s\n", ruta);
+        close(fd);
+        return -1;
+    }
+    void *mapa = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) {
+        perror("mmap diccionario");
+        return -1;
+    }
+    madvise(mapa, st.st_size, MADV_SEQUENTIAL);  // la indexación lo lee de punta a punta
+    d->datos = mapa;
+    d->tam = st.st_size;
+    int res = indexar_diccionario(d);
+    madvise(mapa, st.st_size, MADV_RANDOM);      // después, accesos sueltos
+    return res;
 }
 
-// ========== Función de refresco periódico (thread aparte) ==========
-void *refrescar_estado(void *arg) {
-    // Configurar el hilo para que pueda ser cancelado inmediatamente
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-    
-    while (!shutdown_server) {
-        sleep(INTERVALO_REFRESCO);
-        
-        if (shutdown_server) break;  // Verificar de nuevo después del sleep
+// xorshift64*: rápido, sin estado compartido (cada hilo tiene su semilla)
+uint64_t aleatorio(uint64_t *estado) {
+    uint64_t x = *estado;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *estado = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
 
-        pthread_mutex_lock(&mutex_contador);
-        int act = clientes_activos;
-        int jugadas = total_partidas_jugadas;
-        int ganadas = total_partidas_ganadas;
-        int perdidas = total_partidas_perdidas;
-        pthread_mutex_unlock(&mutex_contador);
+// Sortea una palabra del nivel elegido (o de todos)
+const entrada_palabra_t *palabra_aleatoria(uint64_t *semilla) {
+    diccionario_t *d = &diccionario;
+    if (nivel_elegido != NIVEL_TODOS) {
+        return &d->indice[nivel_elegido][aleatorio(semilla) % d->cantidad[nivel_elegido]];
+    }
+    size_t total = d->cantidad[NIVEL_FACIL] + d->cantidad[NIVEL_MEDIO] + d->cantidad[NIVEL_DIFICIL];
+    size_t k = aleatorio(semilla) % total;
+    for (int nv = 0; nv < NUM_NIVELES; nv++) {
+        if (k < d->cantidad[nv]) return &d->indice[nv][k];
+        k -= d->cantidad[nv];
+    }
+    return NULL;  // No se llega: total > 0 se verifica al arrancar
+}
 
-        double porcentaje = 0.0;
-        if (jugadas > 0) {
-            porcentaje = (double)ganadas / (double)jugadas * 100.0;
-        }
+// ================= Estadísticas sin locks =================
+// Incrementa un contador propio del hilo (un solo escritor: no hace falta un RMW atómico)
+void sumar_n(long *contador, long n) {
+    __atomic_store_n(contador, __atomic_load_n(contador, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
 
-        printf("\n[REFRESCO] Clientes activos: %d\n", act);
-        printf("[REFRESCO] Estadísticas globales:\n");
-        printf("           Partidas jugadas:  %d\n", jugadas);
-        printf("           Partidas ganadas:  %d\n", ganadas);
-        printf("           Partidas perdidas: %d\n", perdidas);
-        printf("           %% Ganadas:        %.2f%%\n", porcentaje);
-        if (act > 0) {
-            printf("[REFRESCO] Hilos de atención activos (pthread_t):\n");
-            for (int i = 0; i < act; i++) {
-                printf("             - %lu\n", (unsigned long)lista_hilos[i]);
+void sumar(long *contador) {
+    sumar_n(contador, 1);
+}
+
+long leer(long *contador) {
+    return __atomic_load_n(contador, __ATOMIC_RELAXED);
+}
+
+// Suma las estadísticas de todos los hilos de eventos
+void leer_estadisticas(estadisticas_t *total) {
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        estadisticas_t *st = &hilos_eventos[i].stats;
+        total->partidas_jugadas    += leer(&st->partidas_jugadas);
+        total->partidas_ganadas    += leer(&st->partidas_ganadas);
+        total->partidas_perdidas   += leer(&st->partidas_perdidas);
+        total->conexiones_cerradas += leer(&st->conexiones_cerradas);
+        total->bytes_recibidos     += leer(&st->bytes_recibidos);
+        total->bytes_enviados      += leer(&st->bytes_enviados);
+        for (int k = 0; k < NUM_TIMEOUTS; k++) {
+            total->expulsadas[k] += leer(&st->expulsadas[k]);
+        }
+        total->difusiones          += leer(&st->difusiones);
+        total->entregas            += leer(&st->entregas);
+        total->lentas              += leer(&st->lentas);
+        for (int k = 0; k < NUM_COMANDOS; k++) {
+            for (int b = 0; b < NUM_CUBETAS; b++) {
+                total->latencia_cubetas[k][b] += leer(&st->latencia_cubetas[k][b]);
             }
+            total->latencia_suma_ns[k] += leer(&st->latencia_suma_ns[k]);
         }
-        printf("[REFRESCO] =========================================\n");
     }
-    
-    printf("[Refresco] Hilo de refresco finalizado.\n");
-    pthread_exit(NULL);
-    return NULL;
 }
 
-// ================ Rutina de cada hilo de cliente =================
-typedef struct {
-    int socket_cliente;
-    int id_cliente;
-} thread_args_t;
-
-void *atender_cliente(void *arg) {
-    thread_args_t *args = (thread_args_t *)arg;
-    int client_fd = args->socket_cliente;
-    int id = args->id_cliente;
-    free(arg);
-
-    // Registrar socket del cliente
-    pthread_mutex_lock(&mutex_sockets);
-    for (int i = 0; i < MAX_CLIENTES; i++) {
-        if (sockets_clientes[i] == 0) {
-            sockets_clientes[i] = client_fd;
-            break;
-        }
+long total_cerradas() {
+    long n = 0;
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        n += leer(&hilos_eventos[i].stats.conexiones_cerradas);
     }
-    pthread_mutex_unlock(&mutex_sockets);
-
-    printf("[Thread %d] Cliente conectado. Clientes activos: %d\n",
-           id, clientes_activos);
+    return n;
+}
 
-    char buffer_recv[128];
-    int bytes;
+int clientes_activos() {
+    return (int)(leer(&conexiones_admitidas) - total_cerradas());
+}
 
-    while (!shutdown_server) {
-        // Si el servidor está cerrando, salimos del bucle
-        if (shutdown_server) {
-            break;
+// Reserva un lugar para un cliente nuevo. La llaman a la vez el hilo principal y los
+// hilos de eventos: el CAS hace que nunca se pase de max_clientes. Devuelve 1 si hay.
+int reservar_cupo() {
+    long admitidas = leer(&conexiones_admitidas);
+    while (admitidas - total_cerradas() < max_clientes) {
+        if (__atomic_compare_exchange_n(&conexiones_admitidas, &admitidas, admitidas + 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 1;
         }
+    }
+    return 0;
+}
 
-        // ================ Iniciar una partida =================
-        int idx = palabra_aleatoria();
-        char palabra_real[MAX_PALABRA];
-        strncpy(palabra_real, lista_palabras[idx], MAX_PALABRA);
-        palabra_real[MAX_PALABRA - 1] = '\0';
-        int len = strlen(palabra_real);
-
-        // Llenar estado con guiones bajos
-        char estado[MAX_PALABRA];
-        for (int i = 0; i < len; i++) {
-            estado[i] = '_';
-        }
-        estado[len] = '\0';
-
-        int intentos_restantes = MAX_INTENTOS;
-        char letras_usadas[64] = "";  
-        // letras_usadas irá acumulando cada letra que el cliente pruebe
-
-        // Contador global de partidas
-        pthread_mutex_lock(&mutex_contador);
-        total_partidas_jugadas++;
-        pthread_mutex_unlock(&mutex_contador);
-
-        // Enviar estado inicial (un solo send)
-        enviar_estado(client_fd, estado, intentos_restantes, letras_usadas, "");
-
-        // ================ Bucle de la partida =================
-        int fin_partida = 0;  // 0=sigue, 1=ganó, 2=perdió, 3=se desconectó/quit
-        while (!fin_partida && !shutdown_server) {
-            memset(buffer_recv, 0, sizeof(buffer_recv));
-            bytes = recv(client_fd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-            if (bytes <= 0) {
-                // Cliente se desconectó inesperadamente durante la partida
-                printf("[Thread %d] Cliente se desconectó o error recv(). Cuenta como pérdida.\n", id);
-                pthread_mutex_lock(&mutex_contador);
-                total_partidas_perdidas++;
-                pthread_mutex_unlock(&mutex_contador);
-                fin_partida = 3;
-                break;
-            }
-            buffer_recv[bytes] = '\0';
-
-            // Eliminar '\n'
-            size_t rlen = strlen(buffer_recv);
-            if (rlen > 0 && buffer_recv[rlen - 1] == '\n') {
-                buffer_recv[rlen - 1] = '\0';
-            }
+// Cubeta HDR de una latencia: el exponente elige el grupo y los BITS_SUBCUBETA bits
+// siguientes al más alto, la cubeta dentro del grupo. Un clz y dos shifts.
+int cubeta_latencia(long ns) {
+    if (ns < SUBCUBETAS) return ns > 0 ? (int)ns : 0;
+    int exp = 63 - __builtin_clzl(ns);
+    if (exp >= MAX_EXP_LATENCIA) return NUM_CUBETAS - 1;   // de 2^MAX_EXP_LATENCIA para arriba
+    return (exp - BITS_SUBCUBETA + 1) * SUBCUBETAS + (int)((ns >> (exp - BITS_SUBCUBETA)) - SUBCUBETAS);
+}
 
-            if (strcmp(buffer_recv, "QUIT") == 0) {
-                // Cliente envió QUIT durante la partida: cuenta como pérdida
-                send(client_fd, "BYE\n", 4, 0);
-                printf("[Thread %d] Cliente solicitó QUIT. Cuenta como pérdida y termina hilo.\n", id);
-                pthread_mutex_lock(&mutex_contador);
-                total_partidas_perdidas++;
-                pthread_mutex_unlock(&mutex_contador);
-                fin_partida = 3;
-                break;
-            }
+// Menor latencia (ns) que cae en la cubeta i: el límite superior de la i-1
+long inicio_cubeta(int i) {
+    if (i < SUBCUBETAS) return i;
+    int grupo = i / SUBCUBETAS;
+    return (long)(SUBCUBETAS + i % SUBCUBETAS) << (grupo - 1);
+}
 
-            if (strncmp(buffer_recv, "TRY:", 4) == 0 && strlen(buffer_recv) == 5) {
-                char letra = buffer_recv[4];
-                int acierto = 0;
+// Latencia del cuantil q (0..1) de un histograma: el límite superior de su cubeta
+long cuantil_latencia(const long *cubetas, double q) {
+    long total = 0;
+    for (int i = 0; i < NUM_CUBETAS; i++) total += cubetas[i];
+    if (total == 0) return 0;
+    long objetivo = (long)(q * total + 0.5);
+    if (objetivo < 1) objetivo = 1;
+    long acum = 0;
+    for (int i = 0; i < NUM_CUBETAS; i++) {
+        acum += cubetas[i];
+        if (acum >= objetivo) return inicio_cubeta(i + 1);
+    }
+    return inicio_cubeta(NUM_CUBETAS);
+}
 
-                // Verificar si la letra ya fue usada
-                if (strchr(letras_usadas, letra) != NULL) {
-                    send(client_fd, "ERROR:Letra ya usada\n", 20, 0);
-                    continue;
-                }
+void registrar_latencia(hilo_eventos_t *h, tipo_comando_t tipo, long ns) {
+    sumar(&h->stats.latencia_cubetas[tipo][cubeta_latencia(ns)]);
+    sumar_n(&h->stats.latencia_suma_ns[tipo], ns);
+}
 
-                // Verificar si quedan intentos
-                if (intentos_restantes <= 0) {
-                    send(client_fd, "ERROR:No quedan intentos\n", 24, 0);
-                    continue;
-                }
+// Guarda una solicitud lenta en el anillo del hilo, pisando la más vieja
+void guardar_lenta(hilo_eventos_t *h, int conexion, const medida_t *m, long total_ns) {
+    solicitud_lenta_t *e = &h->lentas[h->proxima_lenta++ & (MAX_LENTAS - 1)];
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);   // impar: escribiéndola
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e->conexion = conexion;
+    e->tipo = m->tipo;
+    e->hora_ns = ts.tv_sec * 1000000000L + ts.tv_nsec - total_ns;
+    e->total_ns = total_ns;
+    e->proceso_ns = m->armada - m->llegada;
+    memcpy(e->comando, m->comando, sizeof(e->comando));
+
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);   // par: completa
+    sumar(&h->stats.lentas);
+}
 
-                // *** 1) Añadir la letra a 'letras_usadas' si no estaba ya ***
-                int l = strlen(letras_usadas);
-                if (l < (int)sizeof(letras_usadas) - 2) {
-                    letras_usadas[l] = letra;
-                    letras_usadas[l + 1] = '\0';
-                }
+tipo_comando_t tipo_comando(const char *cmd) {
+    if (strncmp(cmd, "TRY:", 4) == 0) return CMD_TRY;
+    if (strncmp(cmd, "TRYN:", 5) == 0) return CMD_TRYN;
+    if (strncmp(cmd, "PLAY", 4) == 0) return CMD_PLAY;
+    if (strncmp(cmd, "QUIT", 4) == 0) return CMD_QUIT;
+    return CMD_OTRO;
+}
 
-                // 2) Actualizar todas las ocurrencias en 'estado'
-                for (int i = 0; i < len; i++) {
-                    if (palabra_real[i] == letra && estado[i] == '_') {
-                        estado[i] = letra;
-                        acierto = 1;
-                    }
-                }
-                if (!acierto) {
-                    intentos_restantes--;
-                }
+long ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
 
-                // Verificar victoria
-                if (strcmp(estado, palabra_real) == 0) {
-                    pthread_mutex_lock(&mutex_contador);
-                    total_partidas_ganadas++;
-                    pthread_mutex_unlock(&mutex_contador);
+// Descuenta un cliente activo y despierta al hilo principal para admitir pendientes
+void liberar_cupo(hilo_eventos_t *h) {
+    sumar(&h->stats.conexiones_cerradas);
 
-                    // Enviar estado + WIN
-                    enviar_estado(client_fd, estado, intentos_restantes, letras_usadas, "WIN");
-                    fin_partida = 1;
-                    break;
-                }
-                // Verificar derrota
-                if (intentos_restantes <= 0) {
-                    pthread_mutex_lock(&mutex_contador);
-                    total_partidas_perdidas++;
-                    pthread_mutex_unlock(&mutex_contador);
-
-                    char msg_lose[64];
-                    snprintf(msg_lose, sizeof(msg_lose), "LOSE|La palabra era:%s", palabra_real);
-                    enviar_estado(client_fd, estado, intentos_restantes, letras_usadas, msg_lose);
-                    fin_partida = 2;
-                    break;
-                }
+    uint64_t uno = 1;
+    if (write(evfd_admision, &uno, sizeof(uno)) < 0) {
+        perror("write evfd_admision");
+    }
+}
 
-                // Sigue jugando: enviar estado actualizado
-                const char *msg_extra = acierto ? "¡Acierto!" : "Letra incorrecta";
-                enviar_estado(client_fd, estado, intentos_restantes, letras_usadas, msg_extra);
+// ===================== Jugadores y ranking =====================
+uint32_t hash_nombre(const char *nombre) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (const char *p = nombre; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h & (TAM_TABLA_JUGADORES - 1);
+}
 
-            } else {
-                send(client_fd, "ERROR: Comando inválido\n", 23, 0);
-            }
+// Nombres de 1 a MAX_NOMBRE caracteres [A-Za-z0-9_-]
+int nombre_valido(const char *nombre) {
+    size_t len = strlen(nombre);
+    if (len == 0 || len > MAX_NOMBRE) return 0;
+    for (const char *p = nombre; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') || *p == '_' || *p == '-')) {
+            return 0;
         }
+    }
+    return 1;
+}
 
-        if (fin_partida == 3 || shutdown_server) {
-            // Cliente se desconectó o pidió QUIT, ya contabilizado como pérdida
-            break;
+// Busca al jugador y, si no existe, lo crea. Los registros no se liberan nunca, así
+// que el puntero sirve mientras dure el servidor.
+jugador_t *obtener_jugador(const char *nombre) {
+    uint32_t cubeta = hash_nombre(nombre);
+    pthread_mutex_t *lock = &franjas_jugadores[cubeta % NUM_FRANJAS];
+
+    pthread_mutex_lock(lock);
+    jugador_t *j = tabla_jugadores[cubeta];
+    while (j && strcmp(j->nombre, nombre) != 0) j = j->sig;
+    if (!j && (j = calloc(1, sizeof(jugador_t))) != NULL) {
+        strcpy(j->nombre, nombre);
+        j->pos_top = -1;
+        j->sig = tabla_jugadores[cubeta];
+        tabla_jugadores[cubeta] = j;
+        __atomic_add_fetch(&num_jugadores, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(lock);
+    return j;
+}
+
+// Acomoda en el ranking a un jugador cuyas ganadas acaban de subir: entra si supera al
+// último y sube mientras supere al de arriba (con empate queda quien llegó primero)
+void actualizar_top(jugador_t *j) {
+    long ganadas = leer(&j->ganadas);
+    pthread_mutex_lock(&mutex_top);
+    int pos = j->pos_top;
+    if (pos < 0) {
+        if (num_top < TOP_K) {
+            pos = num_top++;
+        } else if (ganadas > leer(&top[TOP_K - 1]->ganadas)) {
+            pos = TOP_K - 1;
+            top[pos]->pos_top = -1;
+        } else {
+            pthread_mutex_unlock(&mutex_top);
+            return;
         }
+        top[pos] = j;
+        j->pos_top = pos;
+    }
+    while (pos > 0 && leer(&top[pos - 1]->ganadas) < ganadas) {
+        top[pos] = top[pos - 1];
+        top[pos]->pos_top = pos;
+        pos--;
+        top[pos] = j;
+        j->pos_top = pos;
+    }
+    pthread_mutex_unlock(&mutex_top);
+}
 
-        // ================ Partida finalizada (ganó o perdió) ============
-        // Enviar GAMEOVER
-        if (fin_partida == 1) {
-            send(client_fd, "GAMEOVER:WIN\n", 13, 0);
-        } else if (fin_partida == 2) {
-            char buffer_go[64];
-            snprintf(buffer_go, sizeof(buffer_go), "GAMEOVER:LOSE:%s\n", palabra_real);
-            send(client_fd, buffer_go, strlen(buffer_go), 0);
+// Agrega al log pendiente los totales de un jugador (con el lock de su franja tomado,
+// así las líneas de un mismo jugador quedan en orden)
+void anotar_registro(const jugador_t *j) {
+    if (registro_fd < 0) return;
+    char linea[MAX_NOMBRE + 48];
+    int n = snprintf(linea, sizeof(linea), "%s %ld %ld\n", j->nombre, j->ganadas, j->perdidas);
+
+    pthread_mutex_lock(&mutex_registro);
+    if (registro_len + n > registro_cap) {
+        size_t cap = registro_cap ? registro_cap * 2 : 4096;
+        char *nuevo = realloc(registro_buf, cap);
+        if (!nuevo) {
+            pthread_mutex_unlock(&mutex_registro);
+            return;  // Sin memoria: el próximo snapshot lo recupera
         }
+        registro_buf = nuevo;
+        registro_cap = cap;
+    }
+    memcpy(registro_buf + registro_len, linea, n);
+    registro_len += n;
+    pthread_mutex_unlock(&mutex_registro);
+}
 
-        // Esperar respuesta del cliente: PLAY o QUIT
-        memset(buffer_recv, 0, sizeof(buffer_recv));
-        bytes = recv(client_fd, buffer_recv, sizeof(buffer_recv) - 1, 0);
-        if (bytes <= 0) {
-            // Cliente se desconectó justo tras GAMEOVER: cuenta como pérdida
-            printf("[Thread %d] Cliente se desconectó tras GAMEOVER. Cuenta como pérdida.\n", id);
-            pthread_mutex_lock(&mutex_contador);
-            total_partidas_perdidas++;
-            pthread_mutex_unlock(&mutex_contador);
+// Suma una partida terminada al registro del jugador
+void registrar_resultado(jugador_t *j, int gano) {
+    pthread_mutex_t *lock = &franjas_jugadores[hash_nombre(j->nombre) % NUM_FRANJAS];
+    pthread_mutex_lock(lock);
+    if (gano) {
+        __atomic_store_n(&j->ganadas, j->ganadas + 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&j->perdidas, j->perdidas + 1, __ATOMIC_RELAXED);
+    }
+    anotar_registro(j);
+    pthread_mutex_unlock(lock);
+
+    if (gano) actualizar_top(j);
+}
+
+// Arma la respuesta a TOP: "TOP:nombre:ganadas:perdidas|..." en orden de ranking
+int armar_top(char *buf, size_t tam) {
+    int n = snprintf(buf, tam, "TOP:");
+    pthread_mutex_lock(&mutex_top);
+    for (int i = 0; i < num_top && (size_t)n < tam; i++) {
+        n += snprintf(buf + n, tam - n, "%s%s:%ld:%ld", i > 0 ? "|" : "", top[i]->nombre,
+                      leer(&top[i]->ganadas), leer(&top[i]->perdidas));
+    }
+    pthread_mutex_unlock(&mutex_top);
+    return (size_t)n < tam ? n : (int)tam - 1;
+}
+
+// Escribe en el log lo anotado hasta ahora
+void volcar_registro() {
+    pthread_mutex_lock(&mutex_registro);
+    char *buf = registro_buf;
+    size_t len = registro_len;
+    registro_buf = NULL;
+    registro_len = registro_cap = 0;
+    pthread_mutex_unlock(&mutex_registro);
+
+    size_t escrito = 0;
+    while (escrito < len) {
+        ssize_t n = write(registro_fd, buf + escrito, len - escrito);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write registro jugadores");
             break;
         }
-        buffer_recv[bytes] = '\0';
+        escrito += n;
+    }
+    free(buf);
+}
 
-        // Eliminar '\n' y espacios
-        size_t glen = strlen(buffer_recv);
-        while (glen > 0 && (buffer_recv[glen - 1] == '\n' || buffer_recv[glen - 1] == '\r' || buffer_recv[glen - 1] == ' ')) {
-            buffer_recv[glen - 1] = '\0';
-            glen--;
+// Escribe el estado completo en archivo.snap (vía un temporal + rename, así nunca queda
+// a medias) y vacía el log. Un cambio anotado durante el snapshot puede terminar en el
+// log nuevo con totales más viejos que los del snapshot: al cargar se toma el máximo.
+void escribir_snapshot() {
+    char ruta_snap[512], ruta_tmp[512];
+    snprintf(ruta_snap, sizeof(ruta_snap), "%s.snap", ruta_jugadores);
+    snprintf(ruta_tmp, sizeof(ruta_tmp), "%s.snap.tmp", ruta_jugadores);
+
+    volcar_registro();
+    FILE *f = fopen(ruta_tmp, "w");
+    if (!f) {
+        perror("fopen snapshot jugadores");
+        return;
+    }
+    for (int i = 0; i < TAM_TABLA_JUGADORES; i++) {
+        if (tabla_jugadores[i] == NULL) continue;  // lectura sin lock: solo se agregan
+        pthread_mutex_lock(&franjas_jugadores[i % NUM_FRANJAS]);
+        for (jugador_t *j = tabla_jugadores[i]; j; j = j->sig) {
+            fprintf(f, "%s %ld %ld\n", j->nombre, j->ganadas, j->perdidas);
         }
+        pthread_mutex_unlock(&franjas_jugadores[i % NUM_FRANJAS]);
+    }
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        perror("snapshot jugadores");
+        fclose(f);
+        return;
+    }
+    fclose(f);
+    if (rename(ruta_tmp, ruta_snap) < 0) {
+        perror("rename snapshot jugadores");
+        return;
+    }
+    if (ftruncate(registro_fd, 0) < 0) {
+        perror("ftruncate registro jugadores");
+    }
+}
 
-        if (strcmp(buffer_recv, "PLAY") == 0) {
-            // Jugar otra: volvemos al principio del while principal
-            printf("[Thread %d] Cliente eligió PLAY para nueva partida.\n", id);
-            continue;
-        } else if (strcmp(buffer_recv, "QUIT") == 0) {
-            send(client_fd, "BYE\n", 4, 0);
-            printf("[Thread %d] Cliente eligió QUIT tras GAMEOVER. Cuenta como pérdida y cierra hilo.\n", id);
-            pthread_mutex_lock(&mutex_contador);
-            total_partidas_perdidas++;
-            pthread_mutex_unlock(&mutex_contador);
-            break;
-        } else {
-            // Cualquier otra cosa, cerrar igual
-            send(client_fd, "BYE\n", 4, 0);
-            printf("[Thread %d] Respuesta inesperada tras GAMEOVER ('%s'). Cierra hilo.\n", id, buffer_recv);
-            pthread_mutex_lock(&mutex_contador);
-            total_partidas_perdidas++;
-            pthread_mutex_unlock(&mutex_contador);
-            break;
-        }
+// Aplica un archivo de registros ("nombre ganadas perdidas" por línea) tomando el
+// máximo de cada contador. Un archivo que no existe no es un error.
+void aplicar_registros(const char *ruta) {
+    FILE *f = fopen(ruta, "r");
+    if (!f) return;
+    char nombre[64];
+    long ganadas, perdidas;
+    while (fscanf(f, "%63s %ld %ld", nombre, &ganadas, &perdidas) == 3) {
+        if (!nombre_valido(nombre)) continue;
+        jugador_t *j = obtener_jugador(nombre);
+        if (!j) break;
+        if (ganadas > j->ganadas) j->ganadas = ganadas;
+        if (perdidas > j->perdidas) j->perdidas = perdidas;
     }
+    fclose(f);
+}
 
-    // ================ Cerrar conexión y terminar hilo ================
-    // Eliminar socket del cliente
-    pthread_mutex_lock(&mutex_sockets);
-    for (int i = 0; i < MAX_CLIENTES; i++) {
-        if (sockets_clientes[i] == client_fd) {
-            sockets_clientes[i] = 0;
-            break;
+// Al arrancar (antes de crear hilos): snapshot + log, ranking y log abierto para agregar
+int cargar_jugadores() {
+    char ruta_snap[512];
+    snprintf(ruta_snap, sizeof(ruta_snap), "%s.snap", ruta_jugadores);
+    aplicar_registros(ruta_snap);
+    aplicar_registros(ruta_jugadores);
+
+    for (int i = 0; i < TAM_TABLA_JUGADORES; i++) {
+        for (jugador_t *j = tabla_jugadores[i]; j; j = j->sig) {
+            if (j->ganadas > 0) actualizar_top(j);
         }
     }
-    pthread_mutex_unlock(&mutex_sockets);
 
-    close(client_fd);
+    registro_fd = open(ruta_jugadores, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (registro_fd < 0) {
+        perror("open registro jugadores");
+        return -1;
+    }
+    return 0;
+}
+
+// ===================== Envío no bloqueante =====================
+mensaje_t *crear_mensaje(const char *datos, size_t n) {
+    mensaje_t *m = malloc(sizeof(mensaje_t) + n);
+    if (!m) return NULL;
+    m->refs = 1;
+    m->len = n;
+    memcpy(m->datos, datos, n);
+    return m;
+}
 
-    pthread_mutex_lock(&mutex_contador);
-    clientes_activos--;
-    int rem = clientes_activos;
-    pthread_mutex_unlock(&mutex_contador);
+void soltar_mensaje(mensaje_t *m) {
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0) free(m);
+}
 
-    printf("[Thread %d] Thread finalizado. Quedan %d clientes activos.\n", id, rem);
-    pthread_exit(NULL);
-    return NULL;
+int hay_salida(const conexion_t *c) {
+    return c->salida_fin != c->salida_ini || c->refs_fin != c->refs_ini;
 }
 
-// ========================== main() ============================
-int main() {
-    int new_socket;
-    struct sockaddr_in address;
-    socklen_t addrlen = sizeof(address);
-
-    // Inicializar array de sockets
-    memset(sockets_clientes, 0, sizeof(sockets_clientes));
-
-    // Configurar manejadores de señales
-    struct sigaction sa;
-    sa.sa_handler = handle_sigint;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
-    
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
-        perror("Error configurando manejador SIGINT");
-        exit(EXIT_FAILURE);
+// Hasta dónde llega el tramo del buffer circular que sale antes del próximo mensaje
+// compartido (o todo lo que queda, si no hay)
+unsigned int fin_tramo(const conexion_t *c, unsigned int r) {
+    return r != c->refs_fin ? c->refs[r & (MAX_REFS_SALIDA - 1)].pos : c->salida_fin;
+}
+
+// Descuenta de la cola de salida 'n' bytes enviados, en el mismo orden en que se
+// armaron los iovec: tramo del buffer, mensaje compartido, tramo, ...
+void consumir_salida(conexion_t *c, size_t n) {
+    while (n > 0) {
+        unsigned int del_buffer = fin_tramo(c, c->refs_ini) - c->salida_ini;
+        if (del_buffer > 0) {
+            unsigned int k = n < del_buffer ? n : del_buffer;
+            c->salida_ini += k;
+            n -= k;
+            continue;
+        }
+        mensaje_t *m = c->refs[c->refs_ini & (MAX_REFS_SALIDA - 1)].m;
+        uint32_t resta = m->len - c->ref_enviado;
+        uint32_t k = n < resta ? n : resta;
+        c->ref_enviado += k;
+        n -= k;
+        if (c->ref_enviado == m->len) {
+            soltar_mensaje(m);
+            c->refs_ini++;
+            c->ref_enviado = 0;
+        }
     }
+}
 
-    // También manejar SIGTERM
-    if (sigaction(SIGTERM, &sa, NULL) == -1) {
-        perror("Error configurando manejador SIGTERM");
-        exit(EXIT_FAILURE);
+// Registra la latencia de los comandos respondidos: su respuesta ya salió entera
+void completar_medidas(hilo_eventos_t *h, conexion_t *c) {
+    long ahora = ahora_ns();
+    for (int i = 0; i < c->num_medidas; i++) {
+        medida_t *m = &c->medidas[i];
+        long total = ahora - m->llegada;
+        registrar_latencia(h, m->tipo, total);
+        if (total >= umbral_lento_ns) guardar_lenta(h, c->id, m, total);
     }
+    c->num_medidas = 0;
+}
 
-    srand(time(NULL));
+// Anota un comando recién respondido. Si hay demasiados esperando (muchos comandos en
+// una misma lectura y un cliente que no lee), se completan los anteriores como están.
+void anotar_medida(hilo_eventos_t *h, conexion_t *c, tipo_comando_t tipo, const char *linea) {
+    if (c->num_medidas == MAX_MEDIDAS) completar_medidas(h, c);
+    medida_t *m = &c->medidas[c->num_medidas++];
+    m->tipo = tipo;
+    m->llegada = c->llegada;
+    m->armada = ahora_ns();
+    snprintf(m->comando, sizeof(m->comando), "%s", linea);
+}
 
-    printf("===== INICIO DEL SERVIDOR DE AHORCADO =====\n");
+// Envía lo pendiente de la conexión con un sendmsg() (sendmsg y no writev para poder
+// pasar MSG_NOSIGNAL): el buffer circular va en uno o dos iovec (si da la vuelta) y
+// cada mensaje compartido en el suyo, apuntando a los datos del mensaje. Si el socket
+// se llena, pide EPOLLOUT para continuar; el epoll_ctl solo se hace cuando eso cambia.
+// Devuelve -1 si hay que cerrarla.
+int vaciar_salida(hilo_eventos_t *h, conexion_t *c) {
+    while (hay_salida(c)) {
+        struct iovec iov[MAX_IOV];
+        int niov = 0;
+        unsigned int desde = c->salida_ini;
+        unsigned int r = c->refs_ini;
+        uint32_t enviado = c->ref_enviado;
+        while (niov <= MAX_IOV - 3) {
+            unsigned int hasta = fin_tramo(c, r);
+            if (hasta != desde) {
+                unsigned int pendiente = hasta - desde;
+                unsigned int pos = desde & (MAX_SALIDA - 1);
+                unsigned int primero = MAX_SALIDA - pos < pendiente ? MAX_SALIDA - pos : pendiente;
+                iov[niov].iov_base = c->salida + pos;
+                iov[niov++].iov_len = primero;
+                if (primero < pendiente) {
+                    iov[niov].iov_base = c->salida;
+                    iov[niov++].iov_len = pendiente - primero;
+                }
+                desde = hasta;
+            }
+            if (r == c->refs_fin) break;
+            mensaje_t *m = c->refs[r++ & (MAX_REFS_SALIDA - 1)].m;
+            iov[niov].iov_base = m->datos + enviado;
+            iov[niov++].iov_len = m->len - enviado;
+            enviado = 0;
+        }
 
-    // ---------- 1) Crear socket ----------
-    if ((server_socket_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        consumir_salida(c, n);
+        sumar_n(&h->stats.bytes_enviados, n);
     }
-    printf("Socket creado.\n");
 
-    // ---------- 2) Configurar SO_REUSEADDR ----------
-    int opt = 1;
-    if (setsockopt(server_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt SO_REUSEADDR");
-        close(server_socket_fd);
-        exit(EXIT_FAILURE);
+    int quiere_salida = hay_salida(c);
+    if (!quiere_salida && c->num_medidas > 0) completar_medidas(h, c);
+    if (quiere_salida != c->esperando_salida) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (quiere_salida ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        epoll_ctl(h->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->esperando_salida = quiere_salida;
     }
-    printf("SO_REUSEADDR configurado.\n");
+    return 0;
+}
 
-    // ---------- 3) Configurar dirección ----------
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;  // Aceptar conexiones en todas las interfaces
-    address.sin_port = htons(PUERTO);
+// Agrega un mensaje al buffer de salida, sin enviarlo: las respuestas de toda una
+// tanda de lectura salen juntas en el próximo vaciar_salida()
+int enviar(hilo_eventos_t *h, conexion_t *c, const char *datos, size_t n) {
+    if (c->salida_fin - c->salida_ini + n > MAX_SALIDA) {
+        return -1;  // El cliente no lee: lo damos por colgado
+    }
+    unsigned int pos = c->salida_fin & (MAX_SALIDA - 1);
+    size_t primero = MAX_SALIDA - pos < n ? MAX_SALIDA - pos : n;
+    memcpy(c->salida + pos, datos, primero);
+    memcpy(c->salida, datos + primero, n - primero);
+    c->salida_fin += n;
+    return 0;
+}
 
-    // ---------- 4) bind() ----------
-    if (bind(server_socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("bind");
-        close(server_socket_fd);
-        exit(EXIT_FAILURE);
+// Encola un mensaje compartido tomando una referencia: no se copia
+int enviar_mensaje(conexion_t *c, mensaje_t *m) {
+    if (c->refs_fin - c->refs_ini == MAX_REFS_SALIDA) {
+        return -1;  // Igual que con el buffer lleno: el cliente no lee
     }
-    printf("Bind exitoso en puerto %d.\n", PUERTO);
+    __atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+    ref_salida_t *r = &c->refs[c->refs_fin++ & (MAX_REFS_SALIDA - 1)];
+    r->m = m;
+    r->pos = c->salida_fin;
+    return 0;
+}
 
-    // ---------- 5) listen() ----------
-    if (listen(server_socket_fd, 10) < 0) {
-        perror("listen");
-        close(server_socket_fd);
-        exit(EXIT_FAILURE);
+// Representaciones en texto de la partida (solo se arman al responder)
+// Palabra con las letras descubiertas y '_' en las ocultas
+void texto_revelado(const partida_t *p, char *out) {
+    for (int i = 0; i < p->len; i++) {
+        out[i] = (p->reveladas & (1u << i)) ? p->palabra[i] : '_';
+    }
+    out[p->len] = '\0';
+}
+
+void texto_palabra(const partida_t *p, char *out) {
+    memcpy(out, p->palabra, p->len);
+    out[p->len] = '\0';
+}
+
+// Letras usadas, en orden alfabético
+void texto_usadas(const partida_t *p, char *out) {
+    int n = 0;
+    for (int i = 0; i < 26; i++) {
+        if (p->usadas & (1u << i)) out[n++] = 'a' + i;
     }
-    printf("Servidor escuchando (listen) en puerto %d.\n", PUERTO);
-    printf("Máximo de clientes concurrentes: %d\n\n", MAX_CLIENTES);
+    out[n] = '\0';
+}
 
-    // ---------- 6) Lanzar thread de refresco periódico ----------
-    if (pthread_create(&hilo_refresco, NULL, refrescar_estado, NULL) != 0) {
-        perror("pthread_create hilo_refresco");
-        close(server_socket_fd);
-        exit(EXIT_FAILURE);
+// Arma una trama binaria (cabecera + carga) en 'buf'. Devuelve su largo total.
+size_t armar_trama(char *buf, size_t tam, const partida_t *p, uint8_t opcode, uint8_t detalle, const char *carga) {
+    size_t largo = carga ? strlen(carga) : 0;
+    if (sizeof(cabecera_bin_t) + largo > tam) {
+        largo = tam - sizeof(cabecera_bin_t);
     }
 
-    // ---------- 7) Bucle principal de aceptación ----------
-    while (!shutdown_server) {
-        // Usar select() para esperar conexiones con timeout
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(server_socket_fd, &readfds);
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 500000; // 0.5 segundos
-
-        int sel = select(server_socket_fd + 1, &readfds, NULL, NULL, &tv);
-        if (sel < 0) {
-            if (errno == EINTR) continue; // Interrumpido por señal
-            perror("select");
-            break;
-        }
+    cabecera_bin_t cab;
+    cab.opcode = opcode;
+    cab.intentos = p->intentos > 0 ? p->intentos : 0;
+    cab.detalle = detalle;
+    cab.reservado = 0;
+    cab.letras = htonl(p->usadas);
+    cab.largo = htons(largo);
+
+    memcpy(buf, &cab, sizeof(cab));
+    memcpy(buf + sizeof(cab), carga, largo);
+    return sizeof(cab) + largo;
+}
 
-        // Antes de aceptar, revisar si hay que cerrar por falta de clientes
-        pthread_mutex_lock(&mutex_contador);
-        if (clientes_activos == 0 && siguiente_id > 0) {
-            pthread_mutex_unlock(&mutex_contador);
-            printf("\n[Main] No quedan clientes activos. Cerrando servidor automáticamente.\n");
-            shutdown_server = 1;
-            break;
-        }
-        pthread_mutex_unlock(&mutex_contador);
+// Envía una respuesta de una línea ("BYE", "ERROR:..."): en texto con su '\n',
+// en binario como trama 'opcode' con la línea como carga
+int enviar_linea(hilo_eventos_t *h, conexion_t *c, uint8_t opcode, const char *linea) {
+    char buffer[768];
+    size_t n;
+    if (c->binario) {
+        n = armar_trama(buffer, sizeof(buffer), &c->partida, opcode, DET_NINGUNO, opcode == OP_BYE ? NULL : linea);
+    } else {
+        n = snprintf(buffer, sizeof(buffer), "%s\n", linea);
+    }
+    return enviar(h, c, buffer, n);
+}
 
-        if (sel == 0) {
-            // Timeout, volver a chequear
-            continue;
+// ========== Función para enviar estado al cliente (UN SOLO send()) ==========
+// Arma en 'buffer' la respuesta de estado de la partida 'p' en el formato pedido.
+// Devuelve su largo.
+size_t armar_estado(char *buffer,
+                    size_t tam,
+                    const partida_t *p,
+                    int binario,
+                    uint8_t detalle,
+                    const char *mensaje_extra,
+                    const char *linea_gameover)
+{
+    char revelado[MAX_PALABRA + 1];
+    texto_revelado(p, revelado);
+
+    if (binario) {
+        // Trama STATE y, si la partida terminó, trama GAMEOVER con la palabra real
+        size_t n = armar_trama(buffer, tam, p, OP_STATE, detalle, revelado);
+        if (linea_gameover) {
+            char palabra[MAX_PALABRA + 1];
+            texto_palabra(p, palabra);
+            n += armar_trama(buffer + n, tam - n, p, OP_GAMEOVER, detalle, palabra);
         }
+        return n;
+    }
 
-        if (!FD_ISSET(server_socket_fd, &readfds)) {
-            continue;
-        }
+    // Construir todo en un solo buffer:
+    // Primera línea: STATE:palabra|intentos|letras
+    buffer[0] = '\0';
+    char usadas[27];
+    texto_usadas(p, usadas);
+    int n = snprintf(buffer, tam,
+                     "STATE:%s|%d|%s\n",
+                     revelado, p->intentos, usadas);
 
-        int new_socket = accept(server_socket_fd, (struct sockaddr *)&address, &addrlen);
-        if (new_socket < 0) {
-            if (shutdown_server) break;
-            if (errno == EINTR) continue;  // Interrumpido por señal
-            perror("accept");
-            continue;
-        }
+    // Segunda línea: mensaje extra (WIN/LOSE o "¡Acierto!" / "Letra incorrecta")
+    if (mensaje_extra && strlen(mensaje_extra) > 0) {
+        n += snprintf(buffer + n, tam - n, "%s\n", mensaje_extra);
+    }
 
-        pthread_mutex_lock(&mutex_contador);
-        if (shutdown_server) {
-            pthread_mutex_unlock(&mutex_contador);
-            close(new_socket);
-            break;
-        }
+    // Tercera línea, si la partida terminó: GAMEOVER:WIN o GAMEOVER:LOSE:<palabra>
+    if (linea_gameover) {
+        snprintf(buffer + n, tam - n, "%s\n", linea_gameover);
+    }
+    return strlen(buffer);
+}
 
-        // Si llegamos al máximo, esperamos en bucle hasta que haya hueco
-        while (clientes_activos >= MAX_CLIENTES && !shutdown_server) {
-            pthread_mutex_unlock(&mutex_contador);
-            sleep(1);
-            pthread_mutex_lock(&mutex_contador);
-        }
+// Estado + WIN/LOSE y la línea GAMEOVER de una partida terminada
+size_t armar_fin_partida(char *buffer, size_t tam, const partida_t *p, int binario) {
+    if (p->ocultas == 0) {
+        return armar_estado(buffer, tam, p, binario, DET_WIN, "WIN", "GAMEOVER:WIN");
+    }
 
-        if (shutdown_server) {
-            pthread_mutex_unlock(&mutex_contador);
-            close(new_socket);
-            break;
-        }
+    char palabra[MAX_PALABRA + 1];
+    texto_palabra(p, palabra);
+    char msg_lose[64];
+    snprintf(msg_lose, sizeof(msg_lose), "LOSE|La palabra era:%s", palabra);
+    char buffer_go[64];
+    snprintf(buffer_go, sizeof(buffer_go), "GAMEOVER:LOSE:%s", palabra);
+    return armar_estado(buffer, tam, p, binario, DET_LOSE, msg_lose, buffer_go);
+}
 
-        // Aceptar a este cliente
-        clientes_activos++;
-        int id_actual = ++siguiente_id;
-        printf("[Main] Aceptada conexión #%d. Clientes activos: %d\n", id_actual, clientes_activos);
-        pthread_mutex_unlock(&mutex_contador);
+int enviar_estado_fin(hilo_eventos_t *h,
+                      conexion_t *c,
+                      uint8_t detalle,
+                      const char *mensaje_extra,
+                      const char *linea_gameover)
+{
+    char buffer[512];
+    size_t n = armar_estado(buffer, sizeof(buffer), &c->partida, c->binario,
+                            detalle, mensaje_extra, linea_gameover);
+    // Enviar TODO de golpe
+    return enviar(h, c, buffer, n);
+}
 
-        // Crear thread para atender a este cliente
-        pthread_t tid;
-        thread_args_t *args = malloc(sizeof(thread_args_t));
-        args->socket_cliente = new_socket;
-        args->id_cliente = id_actual;
-        if (pthread_create(&tid, NULL, atender_cliente, args) != 0) {
-            perror("pthread_create atender_cliente");
-            close(new_socket);
-            pthread_mutex_lock(&mutex_contador);
-            clientes_activos--;
-            pthread_mutex_unlock(&mutex_contador);
-            free(args);
-            continue;
+int enviar_estado(hilo_eventos_t *h, conexion_t *c, uint8_t detalle, const char *mensaje_extra) {
+    return enviar_estado_fin(h, c, detalle, mensaje_extra, NULL);
+}
+
+// ========== Función de refresco periódico (thread aparte) ==========
+void *refrescar_estado(void *arg) {
+    struct timespec proximo;
+    clock_gettime(CLOCK_MONOTONIC, &proximo);
+
+    pthread_mutex_lock(&mutex_refresco);
+    while (!shutdown_server) {
+        proximo.tv_sec += INTERVALO_REFRESCO;
+        while (!shutdown_server &&
+               pthread_cond_timedwait(&cond_refresco, &mutex_refresco, &proximo) != ETIMEDOUT) {}
+        if (shutdown_server) break;
+        pthread_mutex_unlock(&mutex_refresco);
+
+        estadisticas_t total;
+        leer_estadisticas(&total);
+        int act = clientes_activos();
+        long jugadas = total.partidas_jugadas;
+        long ganadas = total.partidas_ganadas;
+        long perdidas = total.partidas_perdidas;
+
+        double porcentaje = 0.0;
+        if (jugadas > 0) {
+            porcentaje = (double)ganadas / (double)jugadas * 100.0;
         }
-        // Guardar pthread_t en arreglo para refresco
-        pthread_mutex_lock(&mutex_contador);
-        int idx_hilo = clientes_activos - 1;
-        lista_hilos[idx_hilo] = tid;
-        pthread_mutex_unlock(&mutex_contador);
 
-        pthread_detach(tid);
+        printf("\n[REFRESCO] Clientes activos: %d\n", act);
+        printf("[REFRESCO] Estadísticas globales:\n");
+        printf("           Partidas jugadas:  %ld\n", jugadas);
+        printf("           Partidas ganadas:  %ld\n", ganadas);
+        printf("           Partidas perdidas: %ld\n", perdidas);
+        printf("           %% Ganadas:        %.2f%%\n", porcentaje);
+        printf("[REFRESCO] Jugadores registrados: %ld\n", leer(&num_jugadores));
+        printf("[REFRESCO] Expulsadas por timeout: %ld lectura, %ld inactividad, %ld partida\n",
+               total.expulsadas[TIMEOUT_LECTURA], total.expulsadas[TIMEOUT_INACTIVIDAD],
+               total.expulsadas[TIMEOUT_PARTIDA]);
+        printf("[REFRESCO] Hilos de eventos (pthread_t / conexiones):\n");
+        for (int i = 0; i < num_hilos_eventos; i++) {
+            printf("             - %lu: %d\n", (unsigned long)hilos_eventos[i].hilo,
+                   hilos_eventos[i].num_conexiones);
+        }
+        printf("[REFRESCO] =========================================\n");
+        pthread_mutex_lock(&mutex_refresco);
     }
+    pthread_mutex_unlock(&mutex_refresco);
 
-    // ---------- 8) Cierre limpio ----------
-    printf("\n[Main] Cierre limpio iniciado. Esperando que finalicen los clientes...\n");
-    // Esperar a que todos los clientes (hilos) finalicen
-    while (1) {
-        pthread_mutex_lock(&mutex_contador);
-        int rem = clientes_activos;
-        pthread_mutex_unlock(&mutex_contador);
-        if (rem == 0) break;
-        printf("[Main] Esperando que finalicen %d clientes...\n", rem);
-        sleep(1);
-    }
+    printf("[Refresco] Hilo de refresco finalizado.\n");
+    return NULL;
+}
+
+// ========== Persistencia de jugadores (thread aparte, opción -j) ==========
+// Vuelca el log cada INTERVALO_REGISTRO segundos y escribe un snapshot cada
+// INTERVALO_SNAPSHOT. El último volcado lo hace main() al cerrar, después de que
+// terminaron las partidas.
+void *persistir_jugadores(void *arg) {
+    struct timespec proximo;
+    clock_gettime(CLOCK_MONOTONIC, &proximo);
+    int vueltas = 0;
+
+    pthread_mutex_lock(&mutex_refresco);
+    while (!shutdown_server) {
+        proximo.tv_sec += INTERVALO_REGISTRO;
+        while (!shutdown_server &&
+               pthread_cond_timedwait(&cond_refresco, &mutex_refresco, &proximo) != ETIMEDOUT) {}
+        if (shutdown_server) break;
+        pthread_mutex_unlock(&mutex_refresco);
+
+        if (++vueltas * INTERVALO_REGISTRO >= INTERVALO_SNAPSHOT) {
+            escribir_snapshot();
+            vueltas = 0;
+        } else {
+            volcar_registro();
+        }
+        pthread_mutex_lock(&mutex_refresco);
+    }
+    pthread_mutex_unlock(&mutex_refresco);
+    return NULL;
+}
+
+// ================ Lógica del juego por conexión =================
+// Elige palabra nueva, reinicia el estado y envía el estado inicial
+// Sortea la palabra y deja la partida lista para empezar
+void preparar_partida(hilo_eventos_t *h, partida_t *p) {
+    const entrada_palabra_t *e = palabra_aleatoria(&h->semilla);
+    memset(p, 0, sizeof(*p));
+    p->palabra = diccionario.datos + e->offset;
+    p->len = e->len;
+
+    // Precalcular en qué posiciones aparece cada letra
+    for (int i = 0; i < p->len; i++) {
+        p->posiciones[p->palabra[i] - 'a'] |= 1u << i;
+    }
+    p->ocultas = p->len;
+    p->intentos = MAX_INTENTOS;
+}
+
+int iniciar_partida(hilo_eventos_t *h, conexion_t *c) {
+    preparar_partida(h, &c->partida);
+    c->estado = CONN_JUGANDO;
+    c->inicio_partida = ahora_ns() / 1000000;
+
+    // Contador global de partidas
+    sumar(&h->stats.partidas_jugadas);
+
+    // Enviar estado inicial (un solo send)
+    return enviar_estado(h, c, DET_NINGUNO, "");
+}
+
+void contar_perdida(hilo_eventos_t *h, conexion_t *c) {
+    if (c->sala) return;  // las partidas de sala se cuentan (y se anotan) cuando terminan
+    sumar(&h->stats.partidas_perdidas);
+    // Los contadores globales siguen la regla de siempre (QUIT tras GAMEOVER también
+    // cuenta), pero al jugador solo se le anota si la partida seguía en juego: la que
+    // ya ganó o perdió quedó registrada al terminar
+    if (c->jugador && c->estado == CONN_JUGANDO) registrar_resultado(c->jugador, 0);
+}
+
+typedef enum {
+    JUGADA_ACIERTO,
+    JUGADA_FALLO,
+    JUGADA_REPETIDA
+} resultado_jugada_t;
+
+// Aplica una letra a la partida: la agrega a las usadas y revela sus apariciones
+// (la letra tiene que estar entre 'a' y 'z')
+resultado_jugada_t aplicar_letra(partida_t *p, char letra) {
+    if (p->usadas & LETRA_BIT(letra)) {
+        return JUGADA_REPETIDA;
+    }
+    p->usadas |= LETRA_BIT(letra);
+
+    uint32_t pos = p->posiciones[letra - 'a'];
+    if (pos == 0) {
+        p->intentos--;
+        return JUGADA_FALLO;
+    }
+    p->reveladas |= pos;
+    p->ocultas -= __builtin_popcount(pos);
+    return JUGADA_ACIERTO;
+}
+
+// Si la partida terminó, la marca como finalizada y la cuenta. Devuelve 1 si terminó.
+int verificar_fin_partida(hilo_eventos_t *h, conexion_t *c) {
+    // Verificar victoria
+    if (c->partida.ocultas == 0) {
+        sumar(&h->stats.partidas_ganadas);
+        if (c->jugador) registrar_resultado(c->jugador, 1);
+        c->estado = CONN_FIN_PARTIDA;
+        return 1;
+    }
+    // Verificar derrota
+    if (c->partida.intentos <= 0) {
+        contar_perdida(h, c);
+        c->estado = CONN_FIN_PARTIDA;
+        return 1;
+    }
+    return 0;
+}
+
+// Envía estado + WIN/LOSE y la línea GAMEOVER, todo en un solo envío
+int responder_fin_partida(hilo_eventos_t *h, conexion_t *c) {
+    char buffer[512];
+    size_t n = armar_fin_partida(buffer, sizeof(buffer), &c->partida, c->binario);
+    return enviar(h, c, buffer, n);
+}
+
+// ================ Salas: partidas compartidas =================
+void cerrar_conexion(hilo_eventos_t *h, conexion_t *c);
+
+sala_t **cubeta_sala(const char *nombre) {
+    return &tabla_salas[hash_nombre(nombre) & (TAM_TABLA_SALAS - 1)];
+}
+
+// Arma el estado de la partida de la sala una vez por formato, lo guarda en el
+// historial y avisa a los hilos de eventos con miembros. Con s->mutex tomado.
+void difundir(hilo_eventos_t *h, sala_t *s, uint8_t detalle, const char *extra) {
+    for (int b = 0; b < 2; b++) {
+        char buffer[512];
+        size_t n = s->terminada ? armar_fin_partida(buffer, sizeof(buffer), &s->partida, b)
+                                : armar_estado(buffer, sizeof(buffer), &s->partida, b, detalle, extra, NULL);
+        mensaje_t **ranura = &s->historial[s->seq % HISTORIAL_SALA][b];
+        if (*ranura) soltar_mensaje(*ranura);
+        *ranura = crear_mensaje(buffer, n);  // si falta memoria, esta difusión se saltea
+    }
+    s->resultado[s->seq % HISTORIAL_SALA] = !s->terminada ? 0 : s->partida.ocultas == 0 ? 1 : -1;
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    sumar(&h->stats.difusiones);
+
+    uint64_t uno = 1;
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        if (s->miembros_hilo[i] > 0 && write(hilos_eventos[i].evfd_salas, &uno, sizeof(uno)) < 0) {
+            // El contador del eventfd no puede desbordar en la práctica: no hay nada que hacer
+        }
+    }
+}
+
+// Encola a la conexión, por referencia, las difusiones de su sala que todavía no tiene.
+// Si quedó atrás más que el historial, recibe solo las últimas HISTORIAL_SALA: cada
+// una trae el estado completo, así que saltearse las viejas no pierde nada. La que
+// cierra una partida se anota al jugador (si se identificó): así cuenta para cada uno
+// de los que estaban en la sala, en el hilo que lo atiende.
+int entregar_sala(hilo_eventos_t *h, conexion_t *c) {
+    sala_t *s = c->sala;
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == c->sala_visto) return 0;
+
+    int r = 0, ganadas = 0, perdidas = 0;
+    pthread_mutex_lock(&s->mutex);
+    if (s->seq - c->sala_visto > HISTORIAL_SALA) c->sala_visto = s->seq - HISTORIAL_SALA;
+    for (; c->sala_visto != s->seq && r == 0; c->sala_visto++) {
+        mensaje_t *m = s->historial[c->sala_visto % HISTORIAL_SALA][c->binario];
+        int8_t fin = s->resultado[c->sala_visto % HISTORIAL_SALA];
+        if (fin > 0) ganadas++;
+        else if (fin < 0) perdidas++;
+        if (m) {
+            r = enviar_mensaje(c, m);
+            sumar(&h->stats.entregas);
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    // Fuera del lock de la sala: registrar_resultado toma los del registro
+    if (c->jugador) {
+        while (ganadas-- > 0) registrar_resultado(c->jugador, 1);
+        while (perdidas-- > 0) registrar_resultado(c->jugador, 0);
+    }
+    return r;
+}
+
+// Saca a la conexión de su sala; la sala se libera si era el último miembro
+void salir_sala(hilo_eventos_t *h, conexion_t *c) {
+    sala_t *s = c->sala;
+    if (c->sala_ant) c->sala_ant->sala_sig = c->sala_sig;
+    else h->miembros_sala = c->sala_sig;
+    if (c->sala_sig) c->sala_sig->sala_ant = c->sala_ant;
+    c->sala_ant = c->sala_sig = NULL;
+    c->sala = NULL;
+
+    pthread_mutex_lock(&mutex_salas);
+    pthread_mutex_lock(&s->mutex);
+    s->miembros_hilo[h->id]--;
+    int quedan = --s->num_miembros;
+    pthread_mutex_unlock(&s->mutex);
+    if (quedan == 0) {
+        sala_t **pp = cubeta_sala(s->nombre);
+        while (*pp != s) pp = &(*pp)->sig;
+        *pp = s->sig;
+        __atomic_store_n(&num_salas, num_salas - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&mutex_salas);
+    if (quedan > 0) return;
+
+    for (int k = 0; k < HISTORIAL_SALA; k++) {
+        for (int b = 0; b < 2; b++) {
+            if (s->historial[k][b]) soltar_mensaje(s->historial[k][b]);
+        }
+    }
+    pthread_mutex_destroy(&s->mutex);
+    printf("[Hilo %d] Sala '%s' cerrada.\n", h->id, s->nombre);
+    free(s);
+}
+
+// JOIN:<sala>: se suma a la sala (la crea si no existe) y recibe el estado actual.
+// Una partida propia en curso se abandona y cuenta como perdida.
+int unirse_sala(hilo_eventos_t *h, conexion_t *c, const char *nombre) {
+    if (!nombre_valido(nombre)) {
+        return enviar_linea(h, c, OP_ERROR, "ERROR:Nombre de sala inválido");
+    }
+    if (c->sala) {
+        if (strcmp(c->sala->nombre, nombre) == 0) {
+            return enviar_linea(h, c, OP_ERROR, "ERROR:Ya en la sala");
+        }
+        salir_sala(h, c);
+    } else if (c->estado == CONN_JUGANDO) {
+        contar_perdida(h, c);
+    }
+    c->estado = CONN_FIN_PARTIDA;  // la partida es la de la sala
+
+    pthread_mutex_lock(&mutex_salas);
+    sala_t **cubeta = cubeta_sala(nombre);
+    sala_t *s = *cubeta;
+    while (s && strcmp(s->nombre, nombre) != 0) s = s->sig;
+    if (!s) {
+        s = calloc(1, sizeof(sala_t));
+        if (!s) {
+            pthread_mutex_unlock(&mutex_salas);
+            return enviar_linea(h, c, OP_ERROR, "ERROR:Sin memoria");
+        }
+        strcpy(s->nombre, nombre);
+        pthread_mutex_init(&s->mutex, NULL);
+        preparar_partida(h, &s->partida);
+        sumar(&h->stats.partidas_jugadas);
+        s->sig = *cubeta;
+        *cubeta = s;
+        __atomic_store_n(&num_salas, num_salas + 1, __ATOMIC_RELAXED);
+        printf("[Hilo %d] Sala '%s' creada.\n", h->id, nombre);
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    pthread_mutex_unlock(&mutex_salas);
+    s->num_miembros++;
+    s->miembros_hilo[h->id]++;
+    c->sala = s;
+    c->sala_visto = s->seq;
+
+    // Respuesta propia: confirmación y estado actual (no es una difusión)
+    char ok[MAX_NOMBRE + 32];
+    snprintf(ok, sizeof(ok), "OK:JOIN:%s|%d", s->nombre, s->num_miembros);
+    char buffer[512];
+    size_t n = s->terminada ? armar_fin_partida(buffer, sizeof(buffer), &s->partida, c->binario)
+                            : armar_estado(buffer, sizeof(buffer), &s->partida, c->binario, DET_NINGUNO, "", NULL);
+    pthread_mutex_unlock(&s->mutex);
+
+    c->sala_sig = h->miembros_sala;
+    if (h->miembros_sala) h->miembros_sala->sala_ant = c;
+    h->miembros_sala = c;
+
+    printf("[Conexión %d] Se une a la sala '%s'.\n", c->id, nombre);
+    if (enviar_linea(h, c, OP_INFO, ok) < 0) return -1;
+    return enviar(h, c, buffer, n);
+}
+
+// Comandos de un miembro de una sala. Las jugadas cambian la partida compartida y se
+// difunden a todos (incluido quien jugó, que la recibe enseguida en su misma tanda).
+int procesar_comando_sala(hilo_eventos_t *h, conexion_t *c, char *cmd) {
+    sala_t *s = c->sala;
+    char autor[MAX_NOMBRE + 16];
+    if (c->jugador) snprintf(autor, sizeof(autor), "%s", c->jugador->nombre);
+    else snprintf(autor, sizeof(autor), "#%d", c->id);
+
+    if (strcmp(cmd, "QUIT") == 0) {
+        enviar_linea(h, c, OP_BYE, "BYE");
+        printf("[Conexión %d] Cliente solicitó QUIT en la sala '%s'. Cierra.\n", c->id, s->nombre);
+        return -1;
+    }
+    if (strcmp(cmd, "LEAVE") == 0) {
+        salir_sala(h, c);
+        if (enviar_linea(h, c, OP_INFO, "OK:LEAVE") < 0) return -1;
+        return iniciar_partida(h, c);
+    }
+
+    int es_try = strncmp(cmd, "TRY:", 4) == 0 && strlen(cmd) == 5;
+    int es_tryn = strncmp(cmd, "TRYN:", 5) == 0 && strlen(cmd) > 5;
+    int es_play = strcmp(cmd, "PLAY") == 0;
+    if (!es_try && !es_tryn && !es_play) {
+        return enviar_linea(h, c, OP_ERROR, "ERROR: Comando inválido");
+    }
+    if (es_try && (cmd[4] < 'a' || cmd[4] > 'z')) {
+        return enviar_linea(h, c, OP_ERROR, "ERROR: Comando inválido");
+    }
+
+    const char *error = NULL;
+    pthread_mutex_lock(&s->mutex);
+    if (es_play) {
+        // Otra partida en la sala, para todos
+        if (!s->terminada) {
+            error = "ERROR:Partida en curso";
+        } else {
+            preparar_partida(h, &s->partida);
+            s->terminada = 0;
+            sumar(&h->stats.partidas_jugadas);
+            char extra[MAX_NOMBRE + 32];
+            snprintf(extra, sizeof(extra), "PLAY (%s)", autor);
+            difundir(h, s, DET_NINGUNO, extra);
+        }
+    } else if (s->terminada) {
+        error = "ERROR:Partida terminada (PLAY para otra)";
+    } else if (es_try && (s->partida.usadas & LETRA_BIT(cmd[4]))) {
+        error = "ERROR:Letra ya usada";
+    } else {
+        int aciertos = 0, fallos = 0, ignoradas = 0;
+        for (const char *p = cmd + (es_try ? 4 : 5); *p; p++) {
+            if (s->terminada || *p < 'a' || *p > 'z') {
+                ignoradas++;
+                continue;
+            }
+            switch (aplicar_letra(&s->partida, *p)) {
+                case JUGADA_ACIERTO: aciertos++; break;
+                case JUGADA_FALLO:   fallos++;   break;
+                default:             ignoradas++; break;
+            }
+            if (s->partida.ocultas == 0) {
+                sumar(&h->stats.partidas_ganadas);
+                s->terminada = 1;
+            } else if (s->partida.intentos <= 0) {
+                sumar(&h->stats.partidas_perdidas);
+                s->terminada = 1;
+            }
+        }
+
+        char extra[MAX_NOMBRE + 64];
+        uint8_t detalle;
+        if (es_try) {
+            detalle = aciertos ? DET_ACIERTO : DET_FALLO;
+            snprintf(extra, sizeof(extra), "%s (%s)", aciertos ? "¡Acierto!" : "Letra incorrecta", autor);
+        } else {
+            detalle = DET_BATCH;
+            snprintf(extra, sizeof(extra), "BATCH:%d|%d|%d (%s)", aciertos, fallos, ignoradas, autor);
+        }
+        difundir(h, s, detalle, extra);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    if (error) return enviar_linea(h, c, OP_ERROR, error);
+    return entregar_sala(h, c);
+}
+
+// Despertado por su evfd_salas: encola las difusiones nuevas a sus miembros y las envía.
+// Un miembro que se cierra acá puede tener todavía un evento en la tanda en curso:
+// cerrar_conexion() lo deja marcado y se libera recién al terminarla.
+void entregar_difusiones(hilo_eventos_t *h) {
+    uint64_t avisos;
+    if (read(h->evfd_salas, &avisos, sizeof(avisos)) < 0) {
+        // EAGAIN: otro aviso ya se atendió junto con este
+    }
+    conexion_t *c = h->miembros_sala;
+    while (c) {
+        conexion_t *sig = c->sala_sig;
+        if (entregar_sala(h, c) < 0 || vaciar_salida(h, c) < 0) cerrar_conexion(h, c);
+        c = sig;
+    }
+}
+
+// Procesa un comando recibido (una línea, ya sin '\n'). Devuelve 0 si la conexión sigue, -1 para cerrarla.
+int procesar_comando(hilo_eventos_t *h, conexion_t *c, char *buffer_recv) {
+    int id = c->id;
+
+    // Negociación del formato binario (vale en cualquier momento de la conexión).
+    // La confirmación va en texto; las respuestas siguientes, en tramas.
+    if (strcmp(buffer_recv, CMD_BINARIO) == 0) {
+        int r = enviar(h, c, OK_BINARIO, strlen(OK_BINARIO));
+        c->binario = 1;
+        return r;
+    }
+
+    // Identificación del jugador: una vez por conexión, en cualquier momento. Las
+    // partidas que terminen desde ahí se suman a su registro.
+    if (strncmp(buffer_recv, "HELLO:", 6) == 0) {
+        const char *nombre = buffer_recv + 6;
+        if (!nombre_valido(nombre)) {
+            return enviar_linea(h, c, OP_ERROR, "ERROR:Nombre inválido");
+        }
+        if (c->jugador) {
+            return enviar_linea(h, c, OP_ERROR, "ERROR:Ya identificado");
+        }
+        c->jugador = obtener_jugador(nombre);
+        if (!c->jugador) {
+            return enviar_linea(h, c, OP_ERROR, "ERROR:Sin memoria");
+        }
+        char ok[MAX_NOMBRE + 64];
+        snprintf(ok, sizeof(ok), "OK:HELLO:%s|%ld|%ld", c->jugador->nombre,
+                 leer(&c->jugador->ganadas), leer(&c->jugador->perdidas));
+        printf("[Conexión %d] Jugador identificado: %s\n", id, c->jugador->nombre);
+        return enviar_linea(h, c, OP_INFO, ok);
+    }
+
+    // Ranking (en cualquier momento)
+    if (strcmp(buffer_recv, "TOP") == 0) {
+        char ranking[TOP_K * (MAX_NOMBRE + 44) + 8];
+        armar_top(ranking, sizeof(ranking));
+        return enviar_linea(h, c, OP_INFO, ranking);
+    }
+
+    // Salas (JOIN vale en cualquier momento, también para cambiar de sala)
+    if (strncmp(buffer_recv, "JOIN:", 5) == 0) {
+        return unirse_sala(h, c, buffer_recv + 5);
+    }
+    if (c->sala) {
+        return procesar_comando_sala(h, c, buffer_recv);
+    }
+
+    if (c->estado == CONN_JUGANDO) {
+        if (strcmp(buffer_recv, "QUIT") == 0) {
+            // Cliente envió QUIT durante la partida: cuenta como pérdida
+            enviar_linea(h, c, OP_BYE, "BYE");
+            printf("[Conexión %d] Cliente solicitó QUIT. Cuenta como pérdida y cierra.\n", id);
+            contar_perdida(h, c);
+            return -1;
+        }
+
+        if (strncmp(buffer_recv, "TRY:", 4) == 0 && strlen(buffer_recv) == 5) {
+            char letra = buffer_recv[4];
+
+            // Solo letras de la 'a' a la 'z' (el cliente ya las pasa a minúscula)
+            if (letra < 'a' || letra > 'z') {
+                return enviar_linea(h, c, OP_ERROR, "ERROR: Comando inválido");
+            }
+
+            // Verificar si la letra ya fue usada
+            if (c->partida.usadas & LETRA_BIT(letra)) {
+                return enviar_linea(h, c, OP_ERROR, "ERROR:Letra ya usada");
+            }
+
+            // Verificar si quedan intentos
+            if (c->partida.intentos <= 0) {
+                return enviar_linea(h, c, OP_ERROR, "ERROR:No quedan intentos");
+            }
+
+            int acierto = aplicar_letra(&c->partida, letra) == JUGADA_ACIERTO;
+            if (verificar_fin_partida(h, c)) {
+                return responder_fin_partida(h, c);
+            }
+
+            // Sigue jugando: enviar estado actualizado
+            const char *msg_extra = acierto ? "¡Acierto!" : "Letra incorrecta";
+            return enviar_estado(h, c, acierto ? DET_ACIERTO : DET_FALLO, msg_extra);
+        }
+
+        // TRYN:<letras>: varias letras en un solo comando, se aplican en orden hasta que
+        // la partida termine. Se responde con un único STATE (más GAMEOVER si terminó).
+        if (strncmp(buffer_recv, "TRYN:", 5) == 0 && strlen(buffer_recv) > 5) {
+            int aciertos = 0, fallos = 0, ignoradas = 0;
+            for (const char *p = buffer_recv + 5; *p; p++) {
+                // Se ignoran las letras repetidas, las que no son a-z y las que
+                // sobran después de terminada la partida
+                if (c->estado != CONN_JUGANDO || *p < 'a' || *p > 'z') {
+                    ignoradas++;
+                    continue;
+                }
+                switch (aplicar_letra(&c->partida, *p)) {
+                    case JUGADA_ACIERTO: aciertos++; break;
+                    case JUGADA_FALLO:   fallos++;   break;
+                    default:             ignoradas++; break;
+                }
+                verificar_fin_partida(h, c);
+            }
+            if (c->estado == CONN_FIN_PARTIDA) {
+                return responder_fin_partida(h, c);
+            }
+
+            char msg_batch[64];
+            snprintf(msg_batch, sizeof(msg_batch), "BATCH:%d|%d|%d", aciertos, fallos, ignoradas);
+            return enviar_estado(h, c, DET_BATCH, msg_batch);
+        }
+
+        return enviar_linea(h, c, OP_ERROR, "ERROR: Comando inválido");
+    }
+
+    // ================ Partida finalizada: esperar PLAY o QUIT ============
+    // Eliminar espacios finales
+    size_t glen = strlen(buffer_recv);
+    while (glen > 0 && buffer_recv[glen - 1] == ' ') {
+        buffer_recv[glen - 1] = '\0';
+        glen--;
+    }
+
+    if (strcmp(buffer_recv, "PLAY") == 0) {
+        // Jugar otra: nueva partida en la misma conexión
+        printf("[Conexión %d] Cliente eligió PLAY para nueva partida.\n", id);
+        return iniciar_partida(h, c);
+    } else if (strcmp(buffer_recv, "QUIT") == 0) {
+        enviar_linea(h, c, OP_BYE, "BYE");
+        printf("[Conexión %d] Cliente eligió QUIT tras GAMEOVER. Cuenta como pérdida y cierra.\n", id);
+        contar_perdida(h, c);
+        return -1;
+    } else {
+        // Cualquier otra cosa, cerrar igual
+        enviar_linea(h, c, OP_BYE, "BYE");
+        printf("[Conexión %d] Respuesta inesperada tras GAMEOVER ('%s'). Cierra.\n", id, buffer_recv);
+        contar_perdida(h, c);
+        return -1;
+    }
+}
+
+// ================ Timeouts: rueda de timers por hilo =================
+// Cada conexión está en una sola ranura, la de su vencimiento más próximo, en una lista
+// doblemente enlazada: reprogramarla es O(1). La rueda avanza de a RESOLUCION_RUEDA_MS;
+// un vencimiento a más de una vuelta queda en su ranura y se vuelve a mirar en cada
+// pasada hasta que llegue.
+
+int ranura_de(hilo_eventos_t *h, long vence_ms) {
+    if (vence_ms < h->rueda_ms) vence_ms = h->rueda_ms;  // ya vencido: en la próxima revisión
+    return (vence_ms / RESOLUCION_RUEDA_MS) & (NUM_RANURAS - 1);
+}
+
+void desenganchar_timer(hilo_eventos_t *h, conexion_t *c) {
+    if (c->ranura < 0) return;
+    if (c->rueda_ant) c->rueda_ant->rueda_sig = c->rueda_sig;
+    else h->rueda[c->ranura] = c->rueda_sig;
+    if (c->rueda_sig) c->rueda_sig->rueda_ant = c->rueda_ant;
+    c->rueda_ant = c->rueda_sig = NULL;
+    c->ranura = -1;
+}
+
+// Recalcula el vencimiento más próximo de la conexión y la cambia de ranura si hace falta
+void programar_timer(hilo_eventos_t *h, conexion_t *c) {
+    long vence = c->ultima_actividad + timeout_inactividad_ms;
+    if (c->inicio_linea && c->inicio_linea + TIMEOUT_LECTURA_MS < vence) {
+        vence = c->inicio_linea + TIMEOUT_LECTURA_MS;
+    }
+    if (c->estado == CONN_JUGANDO && c->inicio_partida + TIMEOUT_PARTIDA_MS < vence) {
+        vence = c->inicio_partida + TIMEOUT_PARTIDA_MS;
+    }
+    c->vence = vence;
+
+    int r = ranura_de(h, vence);
+    if (r == c->ranura) return;
+    desenganchar_timer(h, c);
+    c->ranura = r;
+    c->rueda_sig = h->rueda[r];
+    if (h->rueda[r]) h->rueda[r]->rueda_ant = c;
+    h->rueda[r] = c;
+}
+
+// Cierra una conexión vencida. Si estaba jugando, la partida cuenta como perdida
+// (igual que una desconexión).
+void expulsar_conexion(hilo_eventos_t *h, conexion_t *c, long ahora) {
+    motivo_timeout_t motivo = TIMEOUT_INACTIVIDAD;
+    if (c->inicio_linea && c->inicio_linea + TIMEOUT_LECTURA_MS <= ahora) {
+        motivo = TIMEOUT_LECTURA;
+    } else if (c->estado == CONN_JUGANDO && c->inicio_partida + TIMEOUT_PARTIDA_MS <= ahora) {
+        motivo = TIMEOUT_PARTIDA;
+    }
+    sumar(&h->stats.expulsadas[motivo]);
+    printf("[Conexión %d] Timeout de %s. Se expulsa al cliente.\n", c->id, nombres_timeouts[motivo]);
+
+    enviar_linea(h, c, OP_ERROR, "ERROR:Timeout");
+    if (c->estado == CONN_JUGANDO) contar_perdida(h, c);
+    cerrar_conexion(h, c);
+}
+
+// Avanza la rueda hasta el instante actual revisando cada ranura por la que pasa
+void avanzar_rueda(hilo_eventos_t *h) {
+    long ahora = ahora_ns() / 1000000;
+    int pasos = 0;
+    while (h->rueda_ms + RESOLUCION_RUEDA_MS <= ahora && pasos++ < NUM_RANURAS) {
+        conexion_t *c = h->rueda[(h->rueda_ms / RESOLUCION_RUEDA_MS) & (NUM_RANURAS - 1)];
+        while (c) {
+            conexion_t *sig = c->rueda_sig;
+            if (c->vence <= ahora) expulsar_conexion(h, c, ahora);
+            c = sig;
+        }
+        h->rueda_ms += RESOLUCION_RUEDA_MS;
+    }
+    // Atrasada más de una vuelta (ya se revisaron todas las ranuras): alcanzar el reloj
+    if (h->rueda_ms + RESOLUCION_RUEDA_MS <= ahora) {
+        h->rueda_ms = ahora - ahora % RESOLUCION_RUEDA_MS;
+    }
+}
+
+// ms hasta la próxima ranura, o -1 si el hilo no tiene conexiones que vigilar
+int espera_rueda(hilo_eventos_t *h) {
+    if (h->conexiones == NULL) return -1;
+    long resta = h->rueda_ms + RESOLUCION_RUEDA_MS - ahora_ns() / 1000000;
+    return resta > 0 ? (int)resta : 0;
+}
+
+// ================ Captura de tráfico (opción -r) =================
+// Escribe los registros juntados por el hilo. Es una escritura a disco desde el hilo de
+// eventos, pero una cada TAM_BUF_TRAZA bytes o INTERVALO_TRAZA_MS, no una por comando.
+void volcar_traza(hilo_eventos_t *h) {
+    size_t hecho = 0;
+    while (hecho < h->traza_len) {
+        ssize_t n = write(traza_fd, h->traza + hecho, h->traza_len - hecho);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("write traza");
+            break;
+        }
+        hecho += n;
+    }
+    h->traza_len = 0;
+    h->traza_volcada_ms = ahora_ns() / 1000000;
+}
+
+void grabar_traza(hilo_eventos_t *h, long t_ns, int id, uint8_t tipo, const char *linea, size_t largo) {
+    if (h->traza_len + sizeof(registro_traza_t) + largo > TAM_BUF_TRAZA) volcar_traza(h);
+
+    registro_traza_t r;
+    r.t_us = htobe64((t_ns - inicio_traza_ns) / 1000);
+    r.conexion = htonl(id);
+    r.tipo = tipo;
+    r.largo = largo;
+    memcpy(h->traza + h->traza_len, &r, sizeof(r));
+    if (largo > 0) memcpy(h->traza + h->traza_len + sizeof(r), linea, largo);
+    h->traza_len += sizeof(r) + largo;
+}
+
+// ================ Alta y baja de conexiones =================
+void registrar_conexion(hilo_eventos_t *h, int fd, int id) {
+    conexion_t *c = calloc(1, sizeof(conexion_t));
+    if (!c) {
+        perror("calloc conexion");
+        close(fd);
+        liberar_cupo(h);
+        return;
+    }
+    c->fd = fd;
+    c->id = id;
+    c->ranura = -1;
+    c->ultima_actividad = ahora_ns() / 1000000;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    // Cada tanda de respuestas sale en una sola escritura: Nagle solo la demoraría
+    // esperando el ACK (retrasado) de la anterior
+    int uno = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &uno, sizeof(uno));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(h->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl ADD cliente");
+        close(fd);
+        free(c);
+        liberar_cupo(h);
+        return;
+    }
+
+    c->sig = h->conexiones;
+    if (h->conexiones) h->conexiones->ant = c;
+    h->conexiones = c;
+    h->num_conexiones++;
+
+    printf("[Hilo %d] Cliente #%d conectado. Clientes activos: %d\n",
+           h->id, id, clientes_activos());
+
+    if (traza_fd >= 0) grabar_traza(h, ahora_ns(), id, TRAZA_CONEXION, NULL, 0);
+    if (iniciar_partida(h, c) < 0 || vaciar_salida(h, c) < 0) {
+        cerrar_conexion(h, c);
+        return;
+    }
+    programar_timer(h, c);
+}
+
+void cerrar_conexion(hilo_eventos_t *h, conexion_t *c) {
+    // Lo último que se le respondió (BYE, ERROR) sale antes de cerrar, si el socket lo acepta
+    if (hay_salida(c)) vaciar_salida(h, c);
+    if (c->num_medidas > 0) completar_medidas(h, c);  // lo que no llegó a salir, hasta el cierre
+    epoll_ctl(h->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    desenganchar_timer(h, c);
+    while (c->refs_ini != c->refs_fin) {
+        soltar_mensaje(c->refs[c->refs_ini++ & (MAX_REFS_SALIDA - 1)].m);
+    }
+    if (c->sala) salir_sala(h, c);
+
+    if (c->ant) c->ant->sig = c->sig;
+    else h->conexiones = c->sig;
+    if (c->sig) c->sig->ant = c->ant;
+    h->num_conexiones--;
+
+    int id = c->id;
+    if (traza_fd >= 0) grabar_traza(h, ahora_ns(), id, TRAZA_CIERRE, NULL, 0);
+
+    // No se libera todavía: puede quedar un evento suyo más adelante en la tanda de
+    // epoll_wait (si la cerró otra, como el cierre del servidor o una difusión)
+    c->cerrada = 1;
+    c->sig = h->cerradas;
+    h->cerradas = c;
+    liberar_cupo(h);
+    int rem = clientes_activos();
+    printf("[Hilo %d] Conexión #%d cerrada. Quedan %d clientes activos.\n", h->id, id, rem);
+}
+
+// Extrae y procesa todas las líneas completas del buffer de entrada, así varios
+// comandos en un mismo segmento (pipelining) o un comando partido en varios recv()
+// se atienden igual. Devuelve -1 si hay que cerrar la conexión.
+int procesar_lineas(hilo_eventos_t *h, conexion_t *c) {
+    while (c->entrada_revisado != c->entrada_fin) {
+        if (c->entrada[c->entrada_revisado & (TAM_ENTRADA - 1)] != '\n') {
+            c->entrada_revisado++;
+            continue;
+        }
+
+        // Copiar la línea [ini, revisado) sin el '\n' (ni un '\r' final)
+        char linea[MAX_LINEA];
+        unsigned int largo = c->entrada_revisado - c->entrada_ini;
+        if (largo > 0 && c->entrada[(c->entrada_revisado - 1) & (TAM_ENTRADA - 1)] == '\r') largo--;
+        unsigned int copia = largo < MAX_LINEA ? largo : 0;
+        for (unsigned int i = 0; i < copia; i++) {
+            linea[i] = c->entrada[(c->entrada_ini + i) & (TAM_ENTRADA - 1)];
+        }
+        linea[copia] = '\0';
+
+        c->entrada_revisado++;
+        c->entrada_ini = c->entrada_revisado;
+        if (c->descartando) {
+            c->descartando = 0;
+            continue;
+        }
+
+        // Una línea que no entra en MAX_LINEA se rechaza entera, no se ejecuta cortada
+        if (largo >= MAX_LINEA) {
+            if (enviar_linea(h, c, OP_ERROR, "ERROR: Comando inválido") < 0) return -1;
+            continue;
+        }
+
+        long inicio = ahora_ns();
+        if (traza_fd >= 0) grabar_traza(h, inicio, c->id, TRAZA_COMANDO, linea, copia);
+        tipo_comando_t tipo = tipo_comando(linea);
+        int res = procesar_comando(h, c, linea);
+        anotar_medida(h, c, tipo, linea);
+        if (res < 0) return -1;
+        c->ultima_actividad = inicio / 1000000;
+
+        // Cerrando: la partida que terminó ya no ofrece PLAY
+        if (h->cerrando && c->estado == CONN_FIN_PARTIDA) {
+            enviar_linea(h, c, OP_ERROR, "ERROR:Server shutting down");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Lee todo lo disponible (edge-triggered) en el buffer circular de la conexión
+void atender_lectura(hilo_eventos_t *h, conexion_t *c) {
+    while (1) {
+        unsigned int libres = TAM_ENTRADA - (c->entrada_fin - c->entrada_ini);
+        if (libres == 0) {
+            // Una "línea" que llena todo el buffer: se descarta hasta el próximo '\n'
+            c->entrada_ini = c->entrada_revisado = c->entrada_fin;
+            if (!c->descartando && enviar_linea(h, c, OP_ERROR, "ERROR: Comando inválido") < 0) {
+                cerrar_conexion(h, c);
+                return;
+            }
+            c->descartando = 1;
+            libres = TAM_ENTRADA;
+        }
+        unsigned int pos = c->entrada_fin & (TAM_ENTRADA - 1);
+        unsigned int contiguos = TAM_ENTRADA - pos < libres ? TAM_ENTRADA - pos : libres;
+
+        ssize_t bytes = recv(c->fd, c->entrada + pos, contiguos, 0);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Una línea a medio llegar tiene TIMEOUT_LECTURA_MS para completarse
+            if (c->entrada_fin == c->entrada_ini && !c->descartando) {
+                c->inicio_linea = 0;
+            } else if (c->inicio_linea == 0) {
+                c->inicio_linea = ahora_ns() / 1000000;
+            }
+            programar_timer(h, c);
+            return;
+        }
+        if (bytes <= 0) {
+            // Cliente se desconectó inesperadamente: cuenta como pérdida
+            if (c->estado == CONN_JUGANDO) {
+                printf("[Conexión %d] Cliente se desconectó o error recv(). Cuenta como pérdida.\n", c->id);
+            } else {
+                printf("[Conexión %d] Cliente se desconectó tras GAMEOVER. Cuenta como pérdida.\n", c->id);
+            }
+            contar_perdida(h, c);
+            cerrar_conexion(h, c);
+            return;
+        }
+        c->entrada_fin += bytes;
+        c->llegada = ahora_ns();
+        sumar_n(&h->stats.bytes_recibidos, bytes);
+
+        // Todas las respuestas de lo leído salen juntas
+        if (procesar_lineas(h, c) < 0 || vaciar_salida(h, c) < 0) {
+            cerrar_conexion(h, c);
+            return;
+        }
+    }
+}
+
+// ================ Cola MPMC de conexiones =================
+void iniciar_cola_conexiones(cola_conexiones_t *q) {
+    for (size_t i = 0; i < CAPACIDAD_COLA_CONEXIONES; i++) {
+        q->celdas[i].secuencia = i;
+    }
+    q->pos_encolar = 0;
+    q->pos_desencolar = 0;
+}
+
+// Devuelve -1 si la cola está llena
+int encolar_conexion(cola_conexiones_t *q, int fd, int id) {
+    size_t pos = __atomic_load_n(&q->pos_encolar, __ATOMIC_RELAXED);
+    celda_conexion_t *celda;
+    while (1) {
+        celda = &q->celdas[pos & (CAPACIDAD_COLA_CONEXIONES - 1)];
+        size_t sec = __atomic_load_n(&celda->secuencia, __ATOMIC_ACQUIRE);
+        long dif = (long)sec - (long)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->pos_encolar, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->pos_encolar, __ATOMIC_RELAXED);
+        }
+    }
+    celda->fd = fd;
+    celda->id = id;
+    __atomic_store_n(&celda->secuencia, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Devuelve -1 si la cola está vacía
+int desencolar_conexion(cola_conexiones_t *q, int *fd, int *id) {
+    size_t pos = __atomic_load_n(&q->pos_desencolar, __ATOMIC_RELAXED);
+    celda_conexion_t *celda;
+    while (1) {
+        celda = &q->celdas[pos & (CAPACIDAD_COLA_CONEXIONES - 1)];
+        size_t sec = __atomic_load_n(&celda->secuencia, __ATOMIC_ACQUIRE);
+        long dif = (long)sec - (long)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->pos_desencolar, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->pos_desencolar, __ATOMIC_RELAXED);
+        }
+    }
+    *fd = celda->fd;
+    *id = celda->id;
+    __atomic_store_n(&celda->secuencia, pos + CAPACIDAD_COLA_CONEXIONES, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Toma una conexión de la cola compartida. Si otro hilo ya consumió el aviso,
+// la lectura del eventfd falla con EAGAIN y no hay nada que hacer.
+void tomar_conexion(hilo_eventos_t *h) {
+    uint64_t n;
+    int fd, id;
+    if (read(evfd_conexiones, &n, sizeof(n)) != sizeof(n)) return;
+    if (desencolar_conexion(&cola_conexiones, &fd, &id) == 0) {
+        registrar_conexion(h, fd, id);
+    }
+}
+
+// Acepta del socket de escucha propio (a lo sumo MAX_EVENTOS por vez, para no
+// postergar a los clientes ya conectados). Si hay lugar y nadie esperando, el cliente
+// se queda en este hilo; si no, pasa al hilo principal, que le da su turno.
+void aceptar_en_hilo(hilo_eventos_t *h) {
+    for (int i = 0; i < MAX_EVENTOS; i++) {
+        int fd = accept(h->escucha_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        if (__atomic_load_n(&num_pendientes, __ATOMIC_RELAXED) == 0 && reservar_cupo()) {
+            registrar_conexion(h, fd, __atomic_add_fetch(&siguiente_id, 1, __ATOMIC_RELAXED));
+            continue;
+        }
+
+        uint64_t uno = 1;
+        if (encolar_conexion(&cola_espera, fd, 0) < 0) {
+            send(fd, "ERROR:Servidor lleno\n", 21, MSG_NOSIGNAL);
+            close(fd);
+        } else if (write(evfd_admision, &uno, sizeof(uno)) < 0) {
+            perror("write evfd_admision");
+        }
+    }
+}
+
+// ================ Rutina de cada hilo de eventos =================
+// Libera las conexiones cerradas durante la tanda de eventos que terminó
+void liberar_cerradas(hilo_eventos_t *h) {
+    while (h->cerradas) {
+        conexion_t *c = h->cerradas;
+        h->cerradas = c->sig;
+        free(c);
+    }
+}
+
+// Aviso de cierre: deja de aceptar y de tomar conexiones nuevas, despide a quienes no
+// están en medio de una partida y fija el plazo para las que sí
+void iniciar_cierre(hilo_eventos_t *h) {
+    h->cerrando = 1;
+    h->limite_cierre = ahora_ns() + plazo_cierre_ms * 1000000L;
+    epoll_ctl(h->epfd, EPOLL_CTL_DEL, evfd_conexiones, NULL);
+    epoll_ctl(h->epfd, EPOLL_CTL_DEL, h->escucha_fd, NULL);
+    close(h->escucha_fd);
+    h->escucha_fd = -1;
+
+    conexion_t *c = h->conexiones;
+    while (c) {
+        conexion_t *sig = c->sig;
+        if (c->estado != CONN_JUGANDO) {
+            enviar_linea(h, c, OP_ERROR, "ERROR:Server shutting down");
+            cerrar_conexion(h, c);
+        }
+        c = sig;
+    }
+}
+
+void *bucle_eventos(void *arg) {
+    hilo_eventos_t *h = (hilo_eventos_t *)arg;
+    struct epoll_event eventos[MAX_EVENTOS];
+
+    while (1) {
+        // Se espera hasta la próxima ranura de la rueda; al cerrar, a lo sumo hasta el plazo
+        int espera = espera_rueda(h);
+        if (h->cerrando) {
+            long resta_ms = (h->limite_cierre - ahora_ns()) / 1000000;
+            if (h->conexiones == NULL || resta_ms <= 0) break;
+            if (espera < 0 || resta_ms + 1 < espera) espera = (int)resta_ms + 1;
+        }
+
+        // Captura: lo juntado sale antes de dormir sin plazo o si ya pasó un intervalo
+        if (h->traza_len > 0 &&
+            (espera < 0 || ahora_ns() / 1000000 - h->traza_volcada_ms >= INTERVALO_TRAZA_MS)) {
+            volcar_traza(h);
+        }
+
+        int n = epoll_wait(h->epfd, eventos, MAX_EVENTOS, espera);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            conexion_t *c = eventos[i].data.ptr;
+            if (c == MARCA_CIERRE) {
+                if (!h->cerrando) iniciar_cierre(h);
+                continue;
+            }
+            if (c == MARCA_ESCUCHA(h)) {
+                aceptar_en_hilo(h);
+                continue;
+            }
+            if (c == MARCA_SALAS(h)) {
+                entregar_difusiones(h);
+                continue;
+            }
+            if (c == NULL) {
+                tomar_conexion(h);
+                continue;
+            }
+            if (c->cerrada) continue;  // la cerró un evento anterior de esta tanda
+            if (eventos[i].events & EPOLLOUT) {
+                if (vaciar_salida(h, c) < 0) {
+                    cerrar_conexion(h, c);
+                    continue;
+                }
+            }
+            if (eventos[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                atender_lectura(h, c);
+            }
+        }
+        avanzar_rueda(h);
+        liberar_cerradas(h);
+    }
+
+    // Venció el plazo: avisar a los que siguen jugando y liberar sus conexiones
+    if (h->conexiones) {
+        printf("[Hilo %d] Plazo de cierre vencido, se cortan %d partidas en curso.\n",
+               h->id, h->num_conexiones);
+    }
+    while (h->conexiones) {
+        enviar_linea(h, h->conexiones, OP_ERROR, "ERROR:Server shutting down");
+        cerrar_conexion(h, h->conexiones);
+    }
+    liberar_cerradas(h);
+    if (h->traza_len > 0) volcar_traza(h);
+    return NULL;
+}
+
+// Entrega una conexión aceptada al pool: la encola y despierta a un hilo de eventos
+int despachar_conexion(int fd, int id) {
+    if (encolar_conexion(&cola_conexiones, fd, id) < 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    uint64_t uno = 1;
+    if (write(evfd_conexiones, &uno, sizeof(uno)) < 0) {
+        perror("write evfd_conexiones");
+    }
+    return 0;
+}
+
+int iniciar_hilo_eventos(hilo_eventos_t *h, int id, int escucha_fd) {
+    memset(h, 0, sizeof(*h));
+    h->id = id;
+    h->escucha_fd = escucha_fd;
+    h->semilla = ((uint64_t)time(NULL) << 16) ^ (0x9E3779B97F4A7C15ULL * (id + 1));
+    long ahora = ahora_ns() / 1000000;
+    h->rueda_ms = ahora - ahora % RESOLUCION_RUEDA_MS;
+
+    h->epfd = epoll_create1(0);
+    if (h->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    // EPOLLEXCLUSIVE: cada aviso despierta a un solo hilo de eventos, no a todos
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;  // NULL identifica al eventfd de conexiones nuevas
+    if (epoll_ctl(h->epfd, EPOLL_CTL_ADD, evfd_conexiones, &ev) < 0) {
+        perror("epoll_ctl ADD eventfd");
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = MARCA_CIERRE;
+    if (epoll_ctl(h->epfd, EPOLL_CTL_ADD, evfd_cierre, &ev) < 0) {
+        perror("epoll_ctl ADD eventfd cierre");
+        return -1;
+    }
+    ev.data.ptr = MARCA_ESCUCHA(h);
+    if (epoll_ctl(h->epfd, EPOLL_CTL_ADD, escucha_fd, &ev) < 0) {
+        perror("epoll_ctl ADD escucha");
+        return -1;
+    }
+    if (traza_fd >= 0) {
+        h->traza = malloc(TAM_BUF_TRAZA);
+        if (!h->traza) {
+            perror("malloc traza");
+            return -1;
+        }
+        h->traza_volcada_ms = ahora;
+    }
+
+    h->evfd_salas = eventfd(0, EFD_NONBLOCK);
+    ev.data.ptr = MARCA_SALAS(h);
+    if (h->evfd_salas < 0 || epoll_ctl(h->epfd, EPOLL_CTL_ADD, h->evfd_salas, &ev) < 0) {
+        perror("eventfd salas");
+        return -1;
+    }
+
+    if (pthread_create(&h->hilo, NULL, bucle_eventos, h) != 0) {
+        perror("pthread_create bucle_eventos");
+        return -1;
+    }
+    return 0;
+}
+
+// ================ Admisión y cola de pendientes =================
+// Saca el primer pendiente vivo de la cola (hay que verificar num_pendientes > 0 antes)
+int sacar_pendiente() {
+    while (1) {
+        int fd = pendientes[pendientes_ini];
+        pendientes_ini = (pendientes_ini + 1) % MAX_PENDIENTES;
+        if (fd != -1) {
+            __atomic_store_n(&num_pendientes, num_pendientes - 1, __ATOMIC_RELAXED);
+            return fd;
+        }
+    }
+}
+
+// Un pendiente cerró su lado antes de conseguir lugar: se lo borra de la cola
+void quitar_pendiente(int epfd_main, int fd) {
+    for (int i = pendientes_ini; i != pendientes_fin; i = (i + 1) % MAX_PENDIENTES) {
+        if (pendientes[i] == fd) {
+            pendientes[i] = -1;
+            __atomic_store_n(&num_pendientes, num_pendientes - 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    epoll_ctl(epfd_main, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    printf("[Main] Un cliente en espera se fue antes de entrar. Pendientes: %d\n", num_pendientes);
+}
+
+// Le da lugar a un cliente (con el lugar ya reservado): le asigna ID y lo entrega a
+// un hilo de eventos
+void admitir(int fd) {
+    int id_actual = __atomic_add_fetch(&siguiente_id, 1, __ATOMIC_RELAXED);
+    printf("[Main] Aceptada conexión #%d. Clientes activos: %d\n", id_actual, clientes_activos());
+
+    // Entregarlo a un hilo de eventos
+    if (despachar_conexion(fd, id_actual) < 0) {
+        perror("despachar_conexion");
+        close(fd);
+        __atomic_sub_fetch(&conexiones_admitidas, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Admite pendientes, en orden de llegada, mientras haya lugar
+void admitir_pendientes(int epfd_main) {
+    while (num_pendientes > 0 && reservar_cupo()) {
+        int fd = sacar_pendiente();
+        epoll_ctl(epfd_main, EPOLL_CTL_DEL, fd, NULL);
+        admitir(fd);
+    }
+}
+
+// Recibe lo que los hilos de eventos aceptaron sin lugar. Si mientras tanto se liberó
+// uno, entra; si no, el cliente pasa a la cola de pendientes y recibe de inmediato su
+// posición ("BUSY:N").
+void recibir_en_espera(int epfd_main) {
+    int new_socket, id;
+    while (desencolar_conexion(&cola_espera, &new_socket, &id) == 0) {
+        if (num_pendientes == 0 && reservar_cupo()) {
+            admitir(new_socket);
+            continue;
+        }
+
+        if ((pendientes_fin + 1) % MAX_PENDIENTES == pendientes_ini) {
+            send(new_socket, "ERROR:Servidor lleno\n", 21, MSG_NOSIGNAL);
+            close(new_socket);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLRDHUP;
+        ev.data.fd = new_socket;
+        epoll_ctl(epfd_main, EPOLL_CTL_ADD, new_socket, &ev);
+
+        pendientes[pendientes_fin] = new_socket;
+        pendientes_fin = (pendientes_fin + 1) % MAX_PENDIENTES;
+        __atomic_store_n(&num_pendientes, num_pendientes + 1, __ATOMIC_RELAXED);
+
+        char aviso[32];
+        int len = snprintf(aviso, sizeof(aviso), "BUSY:%d\n", num_pendientes);
+        send(new_socket, aviso, len, MSG_NOSIGNAL);
+        printf("[Main] Servidor lleno. Cliente en espera, posición %d.\n", num_pendientes);
+    }
+}
+
+// ======================== Métricas ===========================
+// Arma el texto de métricas (formato de exposición de Prometheus)
+int armar_metricas(char *buf, size_t tam) {
+    estadisticas_t total;
+    leer_estadisticas(&total);
+    long admitidas = leer(&conexiones_admitidas);
+    size_t en_cola = __atomic_load_n(&cola_conexiones.pos_encolar, __ATOMIC_RELAXED) -
+                     __atomic_load_n(&cola_conexiones.pos_desencolar, __ATOMIC_RELAXED);
+    int n = 0;
+
+#define METRICA(tipo, nombre, fmt, valor) \
+    n += snprintf(buf + n, tam - n, "# TYPE " nombre " " tipo "\n" nombre " " fmt "\n", valor); \
+    if ((size_t)n >= tam) return tam - 1;
+
+    METRICA("gauge",   "ahorcado_conexiones_activas", "%ld", admitidas - total.conexiones_cerradas);
+    METRICA("counter", "ahorcado_conexiones_admitidas_total", "%ld", admitidas);
+    METRICA("gauge",   "ahorcado_conexiones_pendientes", "%d",
+            __atomic_load_n(&num_pendientes, __ATOMIC_RELAXED));
+    METRICA("gauge",   "ahorcado_cola_conexiones", "%zu", en_cola);
+    METRICA("counter", "ahorcado_partidas_jugadas_total", "%ld", total.partidas_jugadas);
+    METRICA("counter", "ahorcado_partidas_ganadas_total", "%ld", total.partidas_ganadas);
+    METRICA("counter", "ahorcado_partidas_perdidas_total", "%ld", total.partidas_perdidas);
+    METRICA("counter", "ahorcado_bytes_recibidos_total", "%ld", total.bytes_recibidos);
+    METRICA("counter", "ahorcado_bytes_enviados_total", "%ld", total.bytes_enviados);
+    METRICA("gauge",   "ahorcado_jugadores_registrados", "%ld", leer(&num_jugadores));
+    METRICA("gauge",   "ahorcado_salas_activas", "%ld", leer(&num_salas));
+    METRICA("counter", "ahorcado_difusiones_total", "%ld", total.difusiones);
+    METRICA("counter", "ahorcado_entregas_total", "%ld", total.entregas);
+    METRICA("counter", "ahorcado_solicitudes_lentas_total", "%ld", total.lentas);
+#undef METRICA
+
+    n += snprintf(buf + n, tam - n, "# TYPE ahorcado_conexiones_expulsadas_total counter\n");
+    for (int k = 0; k < NUM_TIMEOUTS && (size_t)n < tam; k++) {
+        n += snprintf(buf + n, tam - n, "ahorcado_conexiones_expulsadas_total{motivo=\"%s\"} %ld\n",
+                      nombres_timeouts[k], total.expulsadas[k]);
+    }
+    if ((size_t)n >= tam) return tam - 1;
+
+    // Histograma con límites en potencias de 2 (en ns), que coinciden con bordes de
+    // grupos HDR: cada uno es la suma de las cubetas de abajo
+    n += snprintf(buf + n, tam - n, "# TYPE ahorcado_latencia_comando_segundos histogram\n");
+    for (int k = 0; k < NUM_COMANDOS && (size_t)n < tam; k++) {
+        long acum = 0;
+        int b = 0;
+        for (int e = EXP_METRICAS_MIN; e <= EXP_METRICAS_MAX && (size_t)n < tam; e++) {
+            for (int fin = cubeta_latencia(1L << e); b < fin; b++) acum += total.latencia_cubetas[k][b];
+            n += snprintf(buf + n, tam - n,
+                          "ahorcado_latencia_comando_segundos_bucket{comando=\"%s\",le=\"%g\"} %ld\n",
+                          nombres_comandos[k], (double)(1L << e) / 1e9, acum);
+        }
+        for (; b < NUM_CUBETAS; b++) acum += total.latencia_cubetas[k][b];
+        n += snprintf(buf + n, tam - n,
+                      "ahorcado_latencia_comando_segundos_bucket{comando=\"%s\",le=\"+Inf\"} %ld\n"
+                      "ahorcado_latencia_comando_segundos_sum{comando=\"%s\"} %g\n"
+                      "ahorcado_latencia_comando_segundos_count{comando=\"%s\"} %ld\n",
+                      nombres_comandos[k], acum,
+                      nombres_comandos[k], total.latencia_suma_ns[k] / 1e9,
+                      nombres_comandos[k], acum);
+    }
+    if ((size_t)n >= tam) return tam - 1;
+
+    // Percentiles calculados de las cubetas HDR (error relativo < 1/SUBCUBETAS)
+    double cuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    n += snprintf(buf + n, tam - n, "# TYPE ahorcado_latencia_comando_cuantil_segundos gauge\n");
+    for (int k = 0; k < NUM_COMANDOS && (size_t)n < tam; k++) {
+        for (int q = 0; q < 4 && (size_t)n < tam; q++) {
+            n += snprintf(buf + n, tam - n,
+                          "ahorcado_latencia_comando_cuantil_segundos{comando=\"%s\",cuantil=\"%g\"} %g\n",
+                          nombres_comandos[k], cuantiles[q],
+                          cuantil_latencia(total.latencia_cubetas[k], cuantiles[q]) / 1e9);
+        }
+    }
+    return (size_t)n < tam ? n : (int)tam - 1;
+}
+
+int comparar_lentas(const void *a, const void *b) {
+    const copia_lenta_t *x = a, *y = b;
+    return (x->s.hora_ns > y->s.hora_ns) - (x->s.hora_ns < y->s.hora_ns);
+}
+
+// Arma el volcado de solicitudes lentas: percentiles por comando (de los histogramas
+// de todos los hilos) y las lentas de todos los anillos, ordenadas por hora. Devuelve
+// un buffer con malloc() y su largo en *len.
+char *armar_lentas(size_t *len) {
+    size_t tam = 4096 + (size_t)num_hilos_eventos * MAX_LENTAS * 160;
+    char *buf = malloc(tam);
+    copia_lenta_t *copia = malloc((size_t)num_hilos_eventos * MAX_LENTAS * sizeof(copia_lenta_t));
+    if (!buf || !copia) {
+        free(buf);
+        free(copia);
+        return NULL;
+    }
+
+    estadisticas_t total;
+    leer_estadisticas(&total);
+    size_t n = snprintf(buf, tam, "# Latencia por comando (recv -> respuesta enviada)\n");
+    for (int k = 0; k < NUM_COMANDOS; k++) {
+        long *cub = total.latencia_cubetas[k];
+        long cuenta = 0;
+        for (int b = 0; b < NUM_CUBETAS; b++) cuenta += cub[b];
+        n += snprintf(buf + n, tam - n, "%-5s n=%-9ld p50=%.3fms p90=%.3fms p99=%.3fms p99.9=%.3fms max=%.3fms\n",
+                      nombres_comandos[k], cuenta,
+                      cuantil_latencia(cub, 0.5) / 1e6, cuantil_latencia(cub, 0.9) / 1e6,
+                      cuantil_latencia(cub, 0.99) / 1e6, cuantil_latencia(cub, 0.999) / 1e6,
+                      cuantil_latencia(cub, 1.0) / 1e6);
+    }
+
+    // Copias consistentes de los anillos: se descarta la que cambió mientras se copiaba
+    int num = 0;
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        for (int j = 0; j < MAX_LENTAS; j++) {
+            solicitud_lenta_t *e = &hilos_eventos[i].lentas[j];
+            unsigned int seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            if (seq == 0 || (seq & 1)) continue;
+            copia[num].s = *e;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) continue;
+            copia[num++].hilo = i;
+        }
+    }
+    qsort(copia, num, sizeof(copia_lenta_t), comparar_lentas);
+
+    n += snprintf(buf + n, tam - n, "# Solicitudes de más de %.3f ms: %ld en total, las últimas %d por hilo\n",
+                  umbral_lento_ns / 1e6, total.lentas, MAX_LENTAS);
+    for (int i = 0; i < num && n < tam; i++) {
+        solicitud_lenta_t *e = &copia[i].s;
+        time_t seg = e->hora_ns / 1000000000L;
+        struct tm tm;
+        localtime_r(&seg, &tm);
+        char hora[32];
+        strftime(hora, sizeof(hora), "%Y-%m-%d %H:%M:%S", &tm);
+        n += snprintf(buf + n, tam - n,
+                      "%s.%06ld hilo=%d conexion=%d comando=%s total=%.3fms proceso=%.3fms envio=%.3fms linea=\"%s\"\n",
+                      hora, (e->hora_ns % 1000000000L) / 1000, copia[i].hilo, e->conexion,
+                      nombres_comandos[e->tipo], e->total_ns / 1e6, e->proceso_ns / 1e6,
+                      (e->total_ns - e->proceso_ns) / 1e6, e->comando);
+    }
+    free(copia);
+    *len = n < tam ? n : tam - 1;
+    return buf;
+}
+
+// Atiende un pedido de métricas en el hilo de métricas. Se lee el pedido (HTTP o una
+// línea cualquiera) y se responde con un encabezado HTTP/1.0 para que sirva tanto para
+// curl/Prometheus como para nc. Los timeouts acotan lo que un colector lento puede
+// demorar a los siguientes y al cierre; la admisión no se entera.
+void servir_metricas(int metrics_fd) {
+    int fd = accept(metrics_fd, NULL, NULL);
+    if (fd < 0) return;
+
+    struct timeval tv = { 0, 100000 };  // 100 ms
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char pedido[512];
+    ssize_t leido = recv(fd, pedido, sizeof(pedido) - 1, 0);
+    if (leido < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        close(fd);
+        return;
+    }
+    pedido[leido > 0 ? leido : 0] = '\0';
+
+    // "GET /lentas" (o una línea "lentas" con nc): volcado de solicitudes lentas; si no, métricas
+    static char cuerpo[MAX_METRICAS];
+    char *datos = cuerpo;
+    size_t len;
+    char *lentas = NULL;
+    if (strstr(pedido, "lentas") && (lentas = armar_lentas(&len)) != NULL) {
+        datos = lentas;
+    } else {
+        len = armar_metricas(cuerpo, sizeof(cuerpo));
+    }
+
+    char encabezado[128];
+    int len_enc = snprintf(encabezado, sizeof(encabezado),
+                           "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %zu\r\n\r\n", len);
+    send(fd, encabezado, len_enc, MSG_NOSIGNAL | MSG_MORE);  // sale junto con el cuerpo
+    send(fd, datos, len, MSG_NOSIGNAL);
+    shutdown(fd, SHUT_WR);
+    close(fd);
+    free(lentas);
+}
+
+// ========== Métricas (thread aparte, opción -m) ==========
+// Espera pedidos en el socket de métricas y el aviso de cierre (evfd_cierre, que nunca
+// se lee), así armar el volcado y enviarlo no frena al bucle de admisión.
+void *atender_metricas(void *arg) {
+    int metrics_fd = *(int *)arg;
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1 metricas");
+        return NULL;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = metrics_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, metrics_fd, &ev);
+    ev.data.fd = evfd_cierre;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, evfd_cierre, &ev);
+
+    int cerrar = 0;
+    while (!cerrar) {
+        struct epoll_event eventos[2];
+        int n = epoll_wait(epfd, eventos, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait metricas");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (eventos[i].data.fd == evfd_cierre) {
+                cerrar = 1;
+            } else {
+                servir_metricas(metrics_fd);
+            }
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+int crear_socket_metricas(int puerto) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket metricas");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Acá el colector habla primero: con TCP_DEFER_ACCEPT el accept() llega recién con
+    // el pedido ya recibido y servir_metricas() casi nunca se queda esperándolo
+    int espera_seg = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &espera_seg, sizeof(espera_seg));
+
+    struct sockaddr_in dir;
+    memset(&dir, 0, sizeof(dir));
+    dir.sin_family = AF_INET;
+    dir.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // Solo colectores locales
+    dir.sin_port = htons(puerto);
+    if (bind(fd, (struct sockaddr *)&dir, sizeof(dir)) < 0 || listen(fd, 16) < 0) {
+        perror("bind/listen metricas");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Crea uno de los sockets de escucha del juego (no bloqueante). Con SO_REUSEPORT
+// todos comparten el puerto y el kernel reparte las conexiones nuevas entre ellos.
+// Sin TCP_DEFER_ACCEPT: en el juego habla primero el servidor (STATE inicial), así
+// que el cliente no manda nada hasta ser atendido.
+int crear_socket_escucha(struct sockaddr_in *address) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEADDR/SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)address, sizeof(*address)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, backlog) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// ========================== main() ============================
+int main(int argc, char *argv[]) {
+    struct sockaddr_in address;
+
+    int opt_c;
+    int puerto_metricas = PUERTO_METRICAS;
+    const char *ruta_diccionario = NULL;
+    while ((opt_c = getopt(argc, argv, "t:c:m:f:d:p:i:xb:j:r:l:")) != -1) {
+        switch (opt_c) {
+            case 't':
+                num_hilos_eventos = atoi(optarg);
+                break;
+            case 'c':
+                max_clientes = atoi(optarg);
+                break;
+            case 'm':
+                puerto_metricas = atoi(optarg);
+                break;
+            case 'f':
+                ruta_diccionario = optarg;
+                break;
+            case 'p':
+                plazo_cierre_ms = atoi(optarg);
+                break;
+            case 'i':
+                timeout_inactividad_ms = atol(optarg) * 1000;
+                break;
+            case 'x':
+                salir_sin_clientes = 1;
+                break;
+            case 'b':
+                backlog = atoi(optarg);
+                break;
+            case 'j':
+                ruta_jugadores = optarg;
+                break;
+            case 'r':
+                ruta_traza = optarg;
+                break;
+            case 'l':
+                umbral_lento_ns = (long)(atof(optarg) * 1000000);
+                break;
+            case 'd':
+                nivel_elegido = NUM_NIVELES + 1;
+                for (int nv = 0; nv <= NIVEL_TODOS; nv++) {
+                    if (strcmp(optarg, nombres_niveles[nv]) == 0) nivel_elegido = nv;
+                }
+                if (nivel_elegido > NIVEL_TODOS) {
+                    fprintf(stderr, "Dificultad inválida: %s (facil|medio|dificil|todos)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: %s [-t hilos_de_eventos] [-c max_clientes] [-m puerto_metricas]\n"
+                                "          [-f diccionario] [-d facil|medio|dificil|todos] [-p plazo_cierre_ms]\n"
+                                "          [-i inactividad_seg] [-x] [-b backlog] [-j archivo_jugadores]\n"
+                                "          [-r archivo_traza] [-l umbral_lento_ms]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (max_clientes < 1) {
+        fprintf(stderr, "Cantidad máxima de clientes inválida\n");
+        exit(EXIT_FAILURE);
+    }
+    if (num_hilos_eventos == 0) {
+        // Por defecto, un hilo de eventos por núcleo disponible
+        num_hilos_eventos = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_hilos_eventos > MAX_HILOS_EVENTOS) num_hilos_eventos = MAX_HILOS_EVENTOS;
+        if (num_hilos_eventos < 1) num_hilos_eventos = 1;
+    }
+    if (num_hilos_eventos < 1 || num_hilos_eventos > MAX_HILOS_EVENTOS) {
+        fprintf(stderr, "Cantidad de hilos de eventos inválida (1..%d)\n", MAX_HILOS_EVENTOS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (plazo_cierre_ms < 0) {
+        fprintf(stderr, "Plazo de cierre inválido\n");
+        exit(EXIT_FAILURE);
+    }
+    if (backlog < 1) {
+        fprintf(stderr, "Backlog inválido\n");
+        exit(EXIT_FAILURE);
+    }
+    if (timeout_inactividad_ms < 1000) {
+        fprintf(stderr, "Timeout de inactividad inválido (mínimo 1 segundo)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (umbral_lento_ns < 0) {
+        fprintf(stderr, "Umbral de solicitud lenta inválido\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // SIGINT/SIGTERM (cierre) y SIGUSR1 (volcado de solicitudes lentas) se bloquean antes
+    // de crear hilos (todos heredan la máscara) y se leen como eventos de un signalfd en
+    // el bucle principal
+    sigset_t senales;
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGINT);
+    sigaddset(&senales, SIGTERM);
+    sigaddset(&senales, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &senales, NULL) != 0) {
+        perror("pthread_sigmask");
+        exit(EXIT_FAILURE);
+    }
+    int sigfd = signalfd(-1, &senales, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigfd < 0) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+
+    // El refresco espera con el reloj monotónico (no le afectan cambios de hora)
+    pthread_condattr_t attr_cond;
+    pthread_condattr_init(&attr_cond);
+    pthread_condattr_setclock(&attr_cond, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond_refresco, &attr_cond);
+    pthread_condattr_destroy(&attr_cond);
+
+    if (cargar_diccionario(&diccionario, ruta_diccionario) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < NUM_FRANJAS; i++) {
+        pthread_mutex_init(&franjas_jugadores[i], NULL);
+    }
+    if (ruta_jugadores && cargar_jugadores() < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (ruta_traza) {
+        traza_fd = open(ruta_traza, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (traza_fd < 0 || write(traza_fd, TRAZA_MAGIA, TRAZA_LARGO_MAGIA) != TRAZA_LARGO_MAGIA) {
+            perror("traza");
+            exit(EXIT_FAILURE);
+        }
+        inicio_traza_ns = ahora_ns();
+    }
+    size_t cant_nivel = 0;
+    for (int nv = 0; nv < NUM_NIVELES; nv++) {
+        if (nivel_elegido == NIVEL_TODOS || nivel_elegido == (nivel_t)nv) cant_nivel += diccionario.cantidad[nv];
+    }
+    if (cant_nivel == 0) {
+        fprintf(stderr, "No hay palabras válidas para el nivel '%s'\n", nombres_niveles[nivel_elegido]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("===== INICIO DEL SERVIDOR DE AHORCADO =====\n");
+
+    // ---------- 1) Configurar dirección ----------
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;  // Aceptar conexiones en todas las interfaces
+    address.sin_port = htons(PUERTO);
+
+    // ---------- 2) Un socket de escucha por hilo de eventos (SO_REUSEPORT) ----------
+    int escuchas[MAX_HILOS_EVENTOS];
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        escuchas[i] = crear_socket_escucha(&address);
+        if (escuchas[i] < 0) exit(EXIT_FAILURE);
+    }
+    printf("Bind exitoso en puerto %d (%d sockets con SO_REUSEPORT).\n", PUERTO, num_hilos_eventos);
+    printf("Servidor escuchando (listen) en puerto %d, backlog %d por socket.\n", PUERTO, backlog);
+    printf("Máximo de clientes concurrentes: %d\n", max_clientes);
+    printf("Modo: %s\n", salir_sin_clientes ? "se cierra al quedar sin clientes (-x)"
+                                             : "persistente (termina con SIGINT/SIGTERM)");
+    printf("Diccionario: %s (%zu fáciles, %zu medias, %zu difíciles), nivel: %s\n",
+           ruta_diccionario ? ruta_diccionario : "lista interna",
+           diccionario.cantidad[NIVEL_FACIL], diccionario.cantidad[NIVEL_MEDIO],
+           diccionario.cantidad[NIVEL_DIFICIL], nombres_niveles[nivel_elegido]);
+    if (ruta_jugadores) {
+        printf("Jugadores: %ld registrados en %s (snapshot cada %d s)\n",
+               num_jugadores, ruta_jugadores, INTERVALO_SNAPSHOT);
+    } else {
+        printf("Jugadores: solo en memoria (sin -j)\n");
+    }
+    if (ruta_traza) printf("Captura de tráfico en %s\n", ruta_traza);
+
+    // ---------- 3) Lanzar hilos de eventos y thread de refresco periódico ----------
+    iniciar_cola_conexiones(&cola_conexiones);
+    iniciar_cola_conexiones(&cola_espera);
+    evfd_conexiones = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE);
+    evfd_cierre = eventfd(0, EFD_NONBLOCK);
+    evfd_admision = eventfd(0, EFD_NONBLOCK);
+    if (evfd_conexiones < 0 || evfd_cierre < 0 || evfd_admision < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        if (iniciar_hilo_eventos(&hilos_eventos[i], i, escuchas[i]) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("Hilos de eventos: %d\n\n", num_hilos_eventos);
+
+    if (pthread_create(&hilo_refresco, NULL, refrescar_estado, NULL) != 0) {
+        perror("pthread_create hilo_refresco");
+        exit(EXIT_FAILURE);
+    }
+    if (ruta_jugadores && pthread_create(&hilo_persistencia, NULL, persistir_jugadores, NULL) != 0) {
+        perror("pthread_create hilo_persistencia");
+        exit(EXIT_FAILURE);
+    }
+
+    // ---------- 4) Bucle principal de admisión ----------
+    // Un epoll propio vigila las señales, los avisos de los hilos de eventos (lugar
+    // liberado o cliente sin lugar) y a los pendientes (solo EPOLLRDHUP, para enterarse
+    // si se van antes de entrar).
+    int epfd_main = epoll_create1(0);
+    if (epfd_main < 0) {
+        perror("epoll_create1 main");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = evfd_admision;
+    epoll_ctl(epfd_main, EPOLL_CTL_ADD, evfd_admision, &ev);
+    ev.data.fd = sigfd;
+    epoll_ctl(epfd_main, EPOLL_CTL_ADD, sigfd, &ev);
+
+    int metrics_fd = -1;
+    if (puerto_metricas > 0) {
+        metrics_fd = crear_socket_metricas(puerto_metricas);
+        if (metrics_fd >= 0 && pthread_create(&hilo_metricas, NULL, atender_metricas, &metrics_fd) != 0) {
+            perror("pthread_create hilo_metricas");
+            close(metrics_fd);
+            metrics_fd = -1;
+        }
+        if (metrics_fd >= 0) {
+            printf("Métricas en http://127.0.0.1:%d/metrics\n", puerto_metricas);
+        }
+    }
+
+    struct epoll_event eventos[MAX_EVENTOS];
+    int cerrar = 0;
+    while (!cerrar) {
+        int n = epoll_wait(epfd_main, eventos, MAX_EVENTOS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait main");
+            break;
+        }
+
+        for (int i = 0; i < n && !cerrar; i++) {
+            int fd = eventos[i].data.fd;
+            if (fd == sigfd) {
+                struct signalfd_siginfo info;
+                if (read(sigfd, &info, sizeof(info)) != sizeof(info)) continue;
+                if (info.ssi_signo == SIGUSR1) {
+                    size_t len;
+                    char *volcado = armar_lentas(&len);
+                    if (volcado) {
+                        printf("\n[Main] Volcado de solicitudes lentas (SIGUSR1):\n");
+                        fwrite(volcado, 1, len, stdout);
+                        fflush(stdout);
+                        free(volcado);
+                    }
+                } else {
+                    printf("\nRecibida %s. Iniciando cierre del servidor...\n",
+                           info.ssi_signo == SIGINT ? "SIGINT (Ctrl+C)" : "SIGTERM");
+                    cerrar = 1;
+                }
+            } else if (fd == evfd_admision) {
+                uint64_t v;
+                while (read(evfd_admision, &v, sizeof(v)) > 0) {}
+                recibir_en_espera(epfd_main);
+            } else {
+                quitar_pendiente(epfd_main, fd);
+            }
+        }
+        if (cerrar) break;
+
+        admitir_pendientes(epfd_main);
+
+        // Con -x, revisar si hay que cerrar por falta de clientes
+        if (salir_sin_clientes && clientes_activos() == 0 && num_pendientes == 0 &&
+            __atomic_load_n(&siguiente_id, __ATOMIC_RELAXED) > 0) {
+            printf("\n[Main] No quedan clientes activos. Cerrando servidor automáticamente.\n");
+            cerrar = 1;
+        }
+    }
+
+    close(sigfd);
+
+    // ---------- 5) Cierre limpio ----------
+    // Los hilos de eventos cierran sus sockets de escucha al recibir el aviso: las
+    // conexiones nuevas se rechazan desde ya
+    printf("\n[Main] Cierre limpio iniciado. Esperando que finalicen los hilos de eventos...\n");
+    pthread_mutex_lock(&mutex_refresco);
+    shutdown_server = 1;
+    pthread_cond_broadcast(&cond_refresco);
+    pthread_mutex_unlock(&mutex_refresco);
+
+    uint64_t uno = 1;
+    if (write(evfd_cierre, &uno, sizeof(uno)) < 0) {
+        perror("write evfd_cierre");
+    }
+
+    // Los que seguían esperando lugar no llegan a jugar
+    while (num_pendientes > 0) {
+        int fd = sacar_pendiente();
+        send(fd, "ERROR:Server shutting down\n", 27, MSG_NOSIGNAL);
+        close(fd);
+    }
+    close(epfd_main);
+
+    for (int i = 0; i < num_hilos_eventos; i++) {
+        pthread_join(hilos_eventos[i].hilo, NULL);
+        close(hilos_eventos[i].epfd);
+        close(hilos_eventos[i].evfd_salas);
+        free(hilos_eventos[i].traza);
+    }
+
+    // Conexiones aceptadas que nadie llegó a atender (ya no hay otros hilos)
+    int fd_resto, id_resto;
+    while (desencolar_conexion(&cola_conexiones, &fd_resto, &id_resto) == 0 ||
+           desencolar_conexion(&cola_espera, &fd_resto, &id_resto) == 0) {
+        send(fd_resto, "ERROR:Server shutting down\n", 27, MSG_NOSIGNAL);
+        close(fd_resto);
+    }
+    if (metrics_fd >= 0) {
+        pthread_join(hilo_metricas, NULL);
+        close(metrics_fd);
+    }
+    close(evfd_admision);
+    close(evfd_conexiones);
+    close(evfd_cierre);
 
-    // Esperar a que el hilo de refresco termine
     pthread_join(hilo_refresco, NULL);
 
+    // Con todas las partidas terminadas, el estado final de los jugadores
+    if (ruta_jugadores) {
+        pthread_join(hilo_persistencia, NULL);
+        escribir_snapshot();
+        close(registro_fd);
+        printf("[Main] Registro de jugadores guardado en %s.snap\n", ruta_jugadores);
+    }
+
+    if (traza_fd >= 0) {
+        close(traza_fd);
+        printf("[Main] Traza guardada en %s\n", ruta_traza);
+    }
+
     printf("[Main] Todos los hilos han finalizado. Servidor cerrado.\n");
     return 0;
 }
@@ -0,0 +1,38 @@
+/*
+ * traza.h
+ *
+ * Formato del archivo de traza que graba el servidor con -r y reproduce replay.c.
+ *
+ * - El archivo empieza con TRAZA_MAGIA (8 bytes) y sigue con registros: una cabecera
+ *   fija de 14 bytes y, en los de tipo TRAZA_COMANDO, 'largo' bytes con la línea que
+ *   mandó el cliente (sin el '\n').
+ * - Cada hilo de eventos junta sus registros y los escribe en bloques, así que el
+ *   archivo no está ordenado por tiempo entre conexiones; los de una misma conexión
+ *   sí quedan en orden (una conexión vive siempre en el mismo hilo).
+ * - Los campos de más de un byte van en orden de red, como en protocolo.h.
+ *
+ * Autor: Tú mismo
+ * Fecha: 2025
+ */
+
+#ifndef TRAZA_H
+#define TRAZA_H
+
+#include <stdint.h>
+
+#define TRAZA_MAGIA "AHTRAZA1"
+#define TRAZA_LARGO_MAGIA 8
+
+// Tipos de registro
+#define TRAZA_CONEXION 1   // la conexión entró a jugar (recibió su primer STATE)
+#define TRAZA_COMANDO  2   // línea completa recibida
+#define TRAZA_CIERRE   3   // la conexión se cerró (por el cliente o por el servidor)
+
+typedef struct __attribute__((packed)) {
+    uint64_t t_us;        // microsegundos desde que arrancó la captura
+    uint32_t conexion;    // id de la conexión en el servidor
+    uint8_t  tipo;        // TRAZA_*
+    uint8_t  largo;       // bytes del comando que siguen a la cabecera
+} registro_traza_t;
+
+#endif
@@ -1,4 +1,5 @@
 // Includes
+#define _GNU_SOURCE // Para sched_setaffinity y las macros CPU_SET
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,18 +12,40 @@
 #include <signal.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sched.h>
 
 // Constantes y estructuras
 #define MAX_FORMULARIOS 100
 #define SHM_KEY 1234 //Identificador unico para memoria compartida. Usado por shmget
 #define SEM_KEY 5678 //Identificador unico para el conjunto de semáforos. Usado por semget
-#define NUM_SEMS 4 //Cantidad de semaforos que se usan.
-
-#define SEM_CARGAR     0
-#define SEM_VALIDAR    1
-#define SEM_ENCRIPTAR  2
-#define SEM_CLASIFICAR 3
-#define NUM_HIJOS 4
+#define NUM_SEMS 5 //Cantidad de semaforos que se usan.
+
+#define SEM_CARGAR      0
+#define SEM_VALIDAR     1
+#define SEM_ENCRIPTAR   2
+#define SEM_CLASIFICAR  3
+#define SEM_DEDUPLICAR  4 // Solo se usa si se pide la etapa de duplicados (-d)
+#define NUM_HIJOS 5
+#define HIJO_DEDUPLICAR 4 // Indice del hijo opcional que va entre validar y encriptar
+
+// Politicas de la etapa deduplicar
+#define DEDUP_NO      0 // Sin etapa de duplicados
+#define DEDUP_PRIMERO 1 // Se queda con el primero de cada DNI y descarta los repetidos
+#define DEDUP_ULTIMO  2 // En los resultados queda solo el ultimo de cada DNI (todos se encriptan y clasifican: al pasar
+                          // uno no se sabe si vendra otro con su DNI, asi que los reemplazados se filtran al final)
+#define DEDUP_MARCAR  3 // Deja pasar todos, marcando los repetidos
+#define DEDUP_BITS  8
+#define DEDUP_SLOTS (1 << DEDUP_BITS) // Tamaño del indice de DNIs (potencia de 2, mayor a 2*MAX_FORMULARIOS)
+#define PATH_CPU "/sys/devices/system/cpu"
+
+// Motivos de rechazo: mascara con las validaciones que fallaron
+#define MOTIVO_ID          0x01
+#define MOTIVO_DNI         0x02
+#define MOTIVO_NOMBRE      0x04
+#define MOTIVO_APELLIDO    0x08
+#define MOTIVO_FECHA       0x10
+#define MOTIVO_TELEFONO    0x20
+#define MOTIVO_DESCRIPCION 0x40
 
 #define DEBUG_SLEEP() sleep(1) // Para simular procesamiento, se puede comentar al ejecutar tambien.
 
@@ -41,13 +64,32 @@ typedef struct
     char nroTelefono[20];
     char tipoForm[20];
     char descripcion[200];
+    unsigned int motivos; // MOTIVO_* que fallaron en validar (0 = valido)
+    int duplicado; // 1 si deduplicar ya habia visto su DNI
+    int ranuraDni; // Entrada del indice de DNIs (-1 = no se registro)
+    int descartado; // 1 si validar o deduplicar lo sacaron del pipeline (el lugar no se reutiliza)
 } Formulario;
 
+typedef struct
+{
+    long dni;      // 0 = entrada libre
+    int ultimoId;  // Id del ultimo formulario visto con este DNI
+    int veces;
+} EntradaDni;
+
 typedef struct 
 {
     int cantidad;
+    int ultimoId; // Ultimo id asignado por cargar (no se reutiliza aunque se rechace el formulario)
     Formulario formularios[MAX_FORMULARIOS];
 
+    int cantidadRechazados; // Formularios apartados por validar ("dead letters"), no pasan por encriptar/clasificar
+    Formulario rechazados[MAX_FORMULARIOS];
+    int rechazadosPerdidos; // Rechazados que no entraron en el arreglo anterior
+
+    EntradaDni dnis[DEDUP_SLOTS]; // Indice de DNIs vistos (direccionamiento abierto)
+    int cantidadDuplicados;
+
     int totalProcesados;
     int cantidadReclamos;
     int cantidadPedidos;
@@ -62,6 +104,9 @@ typedef struct
 int shmid, semid;
 DatosCompartidos* datos;
 
+int cpus_hijos[NUM_HIJOS] = {-1, -1, -1, -1, -1}; // Core de cada hijo (-1 = lo decide el scheduler)
+int politicaDedup = DEDUP_NO;
+
 // Funciones auxiliares: P, V, crear memoria, etc.
 void P(int semid, int semnum) 
 {
@@ -76,6 +121,35 @@ void V(int semid, int semnum)
 }
 
 //Otros
+// Registra un DNI en el indice y devuelve su entrada (NULL si el indice esta lleno). *repetido queda en 1 si ya estaba.
+// Las entradas se toman con compare-and-swap sobre el DNI, por lo que no hace falta semaforo para el indice.
+EntradaDni* registrarDni(DatosCompartidos* datos, long dni, int id, int* repetido)
+{
+    unsigned long h = ((unsigned long)dni * 0x9E3779B97F4A7C15UL) >> (64 - DEDUP_BITS);
+
+    for (int i = 0; i < DEDUP_SLOTS; i++)
+    {
+        EntradaDni* e = &datos->dnis[(h + i) & (DEDUP_SLOTS - 1)];
+        long esperado = 0;
+        if (__atomic_compare_exchange_n(&e->dni, &esperado, dni, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || esperado == dni)
+        {
+            *repetido = __atomic_fetch_add(&e->veces, 1, __ATOMIC_ACQ_REL) > 0;
+            __atomic_store_n(&e->ultimoId, id, __ATOMIC_RELEASE);
+            return e;
+        }
+    }
+    *repetido = 0;
+    return NULL;
+}
+
+// Con politica DEDUP_ULTIMO un formulario cuenta solo si es el ultimo de su DNI
+int esVigente(DatosCompartidos* datos, Formulario* f)
+{
+    if (politicaDedup != DEDUP_ULTIMO || f->ranuraDni < 0)
+        return 1;
+    return datos->dnis[f->ranuraDni].ultimoId == f->id;
+}
+
 void finalizar() 
 {
     datos->finalizar = 1;
@@ -89,6 +163,115 @@ void handler_SIGINT(int sig)
     terminar = 1;
 }
 
+//Afinidad de CPU
+// Lee una lista de cores de sysfs con formato "0-3,8,10-11"
+int leerListaCpus(const char* ruta, cpu_set_t* set)
+{
+    char linea[256];
+    CPU_ZERO(set);
+    FILE* fp = fopen(ruta, "r");
+    if (!fp)
+        return -1;
+    if (!fgets(linea, sizeof(linea), fp))
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    for (char* tok = strtok(linea, ",\n"); tok; tok = strtok(NULL, ",\n"))
+    {
+        int desde, hasta;
+        int n = sscanf(tok, "%d-%d", &desde, &hasta);
+        if (n < 1)
+            continue;
+        if (n == 1)
+            hasta = desde;
+        for (int c = desde; c <= hasta && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+    }
+    return 0;
+}
+
+// Busca un core permitido y no usado dentro del archivo de topologia 'archivo' del core 'cpu'
+int vecinoLibre(int cpu, const char* archivo, cpu_set_t* permitidos, cpu_set_t* usados)
+{
+    char ruta[128];
+    cpu_set_t set;
+    snprintf(ruta, sizeof(ruta), PATH_CPU "/cpu%d/%s", cpu, archivo);
+    if (leerListaCpus(ruta, &set) < 0)
+        return -1;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+    {
+        if (CPU_ISSET(c, &set) && CPU_ISSET(c, permitidos) && !CPU_ISSET(c, usados))
+            return c;
+    }
+    return -1;
+}
+
+// Completa los cores en -1 ubicando cada hijo cerca del anterior (la etapa con la que comparte
+// los formularios): primero un hermano SMT, despues un core que comparta L3, y si no cualquier core libre.
+// Si hay menos cores que hijos, se reutilizan.
+void planificarCpus(int cpus[], int n)
+{
+    cpu_set_t permitidos, usados;
+    CPU_ZERO(&usados);
+    if (sched_getaffinity(0, sizeof(permitidos), &permitidos) == -1)
+    {
+        perror("sched_getaffinity");
+        return;
+    }
+    int total = CPU_COUNT(&permitidos);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (cpus[i] >= 0)
+        {
+            CPU_SET(cpus[i], &usados);
+            continue;
+        }
+        if (CPU_COUNT(&usados) >= total)
+            CPU_ZERO(&usados);
+
+        int c = -1;
+        if (i > 0)
+        {
+            c = vecinoLibre(cpus[i - 1], "topology/thread_siblings_list", &permitidos, &usados);
+            if (c < 0)
+                c = vecinoLibre(cpus[i - 1], "cache/index3/shared_cpu_list", &permitidos, &usados);
+        }
+        for (int k = 0; c < 0 && k < CPU_SETSIZE; k++)
+        {
+            if (CPU_ISSET(k, &permitidos) && !CPU_ISSET(k, &usados))
+                c = k;
+        }
+        cpus[i] = c;
+        CPU_SET(c, &usados);
+    }
+}
+
+// Un core pedido con -p sirve si el proceso puede correr en el (esta en linea y en su afinidad).
+// Si no hay forma de saberlo se acepta, y si no existe lo informara sched_setaffinity en el hijo.
+int cpuValida(int cpu)
+{
+    cpu_set_t permitidos;
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return 0;
+    if (sched_getaffinity(0, sizeof(permitidos), &permitidos) == -1 &&
+        leerListaCpus(PATH_CPU "/online", &permitidos) < 0)
+        return 1;
+    return CPU_ISSET(cpu, &permitidos);
+}
+
+void fijarCpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        perror("sched_setaffinity");
+}
+
 // Validaciones
 int esSoloLetras(char* texto) 
 {
@@ -156,14 +339,23 @@ void liberar_memoria(int shmid, DatosCompartidos* datos)
 //Manejo de semaforos
 int crear_semaforos() 
 {
-    int semid = semget(SEM_KEY, NUM_SEMS, IPC_CREAT | 0666);
+    // Si quedo un conjunto de una corrida anterior (por ejemplo de cuando eran 4 semaforos) se borra y se crea
+    // de nuevo: semget con IPC_CREAT devolveria el viejo, o fallaria con EINVAL si tiene menos semaforos.
+    int semid = semget(SEM_KEY, NUM_SEMS, IPC_CREAT | IPC_EXCL | 0666);
+    if (semid == -1 && errno == EEXIST)
+    {
+        int viejo = semget(SEM_KEY, 0, 0);
+        if (viejo != -1)
+            semctl(viejo, 0, IPC_RMID);
+        semid = semget(SEM_KEY, NUM_SEMS, IPC_CREAT | IPC_EXCL | 0666);
+    }
     if (semid == -1) 
     {
         perror("semget");
         exit(1);
     }
     // Inicializar semaforos
-    unsigned short vals[NUM_SEMS] = {1,0,0,0};
+    unsigned short vals[NUM_SEMS] = {1,0,0,0,0};
     if (semctl(semid, 0, SETALL, vals) == -1) 
     {
         perror("semctl SETALL");
@@ -208,8 +400,14 @@ void cargarFormulario(DatosCompartidos* datos, int semid)
             break; // Salimos del bucle si no hay más líneas
         }
 
+        if (linea[0] == '#') // Comentario (por ejemplo al reprocesar rechazados.txt)
+        {
+            V(semid, SEM_CARGAR);
+            continue;
+        }
+
         Formulario f;
-        f.id = datos->cantidad + 1;
+        f.id = datos->ultimoId + 1;
         int cant = sscanf(linea, "%ld %29s %29s %19s %19s %[^\n]",
                             &f.dni, f.nombre, f.apellido,
                             f.fechaNac, f.nroTelefono, f.descripcion);
@@ -222,6 +420,11 @@ void cargarFormulario(DatosCompartidos* datos, int semid)
             continue;
         }
         strcpy(f.tipoForm, "");
+        f.motivos = 0;
+        f.duplicado = 0;
+        f.ranuraDni = -1;
+        f.descartado = 0;
+        datos->ultimoId = f.id;
 
         
         if (datos->cantidad < MAX_FORMULARIOS) 
@@ -280,15 +483,40 @@ void validarFormulario(DatosCompartidos* datos, int semid)
         int idx = datos->cantidad - 1;
         Formulario* f = &datos->formularios[idx]; //Nos posicionamos en el nro de formulario que corresponde.
 
-        // Validacion simplificada
-        if (f->id <= 0 || f->dni < 1000000 || f->dni > 100000000 || strlen(f->nombre) == 0 || strlen(f->apellido) == 0 || strlen(f->fechaNac) == 0 ||
-            !esSoloLetras(f->nombre) || !esSoloLetras(f->apellido) || strlen(f->nroTelefono) == 0 || !esSoloNumeros(f->nroTelefono) || strlen(f->descripcion) == 0) 
+        // Validacion simplificada: se acumula en la mascara cada control que falla
+        f->motivos = 0;
+        if (f->id <= 0)
+            f->motivos |= MOTIVO_ID;
+        if (f->dni < 1000000 || f->dni > 100000000)
+            f->motivos |= MOTIVO_DNI;
+        if (strlen(f->nombre) == 0 || !esSoloLetras(f->nombre))
+            f->motivos |= MOTIVO_NOMBRE;
+        if (strlen(f->apellido) == 0 || !esSoloLetras(f->apellido))
+            f->motivos |= MOTIVO_APELLIDO;
+        if (strlen(f->fechaNac) == 0)
+            f->motivos |= MOTIVO_FECHA;
+        if (strlen(f->nroTelefono) == 0 || !esSoloNumeros(f->nroTelefono))
+            f->motivos |= MOTIVO_TELEFONO;
+        if (strlen(f->descripcion) == 0)
+            f->motivos |= MOTIVO_DESCRIPCION;
+
+        if (f->motivos) 
         {
-            
-            printf("Validar: Formulario %d invalido. Se elimina.\n", f->id);
-            // Eliminar formulario invalido (simplemente reducimos cantidad para mantener consistencia de id)
-            datos->cantidad--;
+            printf("Validar: Formulario %d invalido (motivos 0x%02x). Se aparta en rechazados.\n", f->id, f->motivos);
+            // Lo copiamos a la cola de rechazados y lo marcamos descartado para que no cuente en los resultados
+            if (datos->cantidadRechazados < MAX_FORMULARIOS)
+                datos->rechazados[datos->cantidadRechazados++] = *f;
+            else
+            {
+                datos->rechazadosPerdidos++;
+                fprintf(stderr, "Validar: no hay lugar en rechazados, el formulario %d no se guarda.\n", f->id);
+            }
+            f->descartado = 1;
             V(semid, SEM_CARGAR); //Habilito la carga de un nuevo formulario.
+            if (datos->ultimo && idx + 1 == datos->cantidad) // Era el último: no llega nada más a esta etapa
+                esperando_final = 1;
+            if (esperando_final)
+                P(semid, SEM_VALIDAR);// Solo espero la orden del padre
             continue;
         } 
         else 
@@ -298,7 +526,7 @@ void validarFormulario(DatosCompartidos* datos, int semid)
 
         DEBUG_SLEEP(); // Simulamos procesamiento
         
-        V(semid, SEM_ENCRIPTAR);  // Paso al siguiente proceso
+        V(semid, politicaDedup != DEDUP_NO ? SEM_DEDUPLICAR : SEM_ENCRIPTAR);  // Paso al siguiente proceso
 
         if (datos->ultimo && idx + 1 == datos->cantidad) // Verificamos si es el último formulario
             esperando_final = 1;
@@ -311,6 +539,61 @@ void validarFormulario(DatosCompartidos* datos, int semid)
     exit(EXIT_SUCCESS);
 }
 
+void deduplicarFormulario(DatosCompartidos* datos, int semid)
+{
+    int esperando_final = 0;
+    while (!terminar && !datos->finalizar)
+    {
+        P(semid, SEM_DEDUPLICAR);
+
+        if (datos->finalizar)
+        {
+            printf("deduplicarFormulario finalizó.\n");
+            exit(EXIT_SUCCESS);
+        }
+
+        int idx = datos->cantidad - 1;
+        Formulario* f = &datos->formularios[idx];
+
+        int repetido;
+        EntradaDni* e = registrarDni(datos, f->dni, f->id, &repetido);
+        if (e == NULL)
+            fprintf(stderr, "Deduplicar: indice de DNIs lleno, el formulario %d pasa sin verificar.\n", f->id);
+        else
+            f->ranuraDni = (int)(e - datos->dnis);
+
+        if (repetido)
+        {
+            datos->cantidadDuplicados++;
+            if (politicaDedup == DEDUP_PRIMERO)
+            {
+                // Igual que un invalido: queda marcado y no pasa por encriptar/clasificar
+                printf("Deduplicar: Formulario %d con DNI repetido. Se descarta.\n", f->id);
+                f->descartado = 1;
+                V(semid, SEM_CARGAR);
+                if (datos->ultimo && idx + 1 == datos->cantidad) // Era el último: no llega nada más a esta etapa
+                    esperando_final = 1;
+                if (esperando_final)
+                    P(semid, SEM_DEDUPLICAR);// Solo espero la orden del padre
+                continue;
+            }
+            if (politicaDedup == DEDUP_MARCAR)
+                f->duplicado = 1;
+            printf("Deduplicar: Formulario %d con DNI repetido.\n", f->id);
+        }
+
+        V(semid, SEM_ENCRIPTAR);
+
+        if (datos->ultimo && idx + 1 == datos->cantidad) // Verificamos si es el último formulario
+            esperando_final = 1;
+
+        if (esperando_final)
+            P(semid, SEM_DEDUPLICAR);// Ya procesé el último, solo espero la orden del padre
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
 void encriptarFormulario(DatosCompartidos* datos, int semid) 
 {
     int esperando_final = 0;
@@ -400,12 +683,21 @@ void crear_hijos(int shmid, int semid, pid_t pids[])
 {
     for (int i = 0; i < NUM_HIJOS; i++) 
     {
+        if (i == HIJO_DEDUPLICAR && politicaDedup == DEDUP_NO)
+        {
+            pids[i] = -1; // Etapa opcional no pedida
+            continue;
+        }
+
         pid_t pid = fork();  // Creamos un proceso hijo
 
         if (pid == 0) //Si pid == 0 es el proceso hijo, no el padre.
         {
             // Codigo que se ejecuta SOLO en el hijo
 
+            if (cpus_hijos[i] >= 0)
+                fijarCpu(cpus_hijos[i]); // Fijamos el hijo a su core antes de tocar la memoria compartida
+
             // Nos conectamos a la memoria compartida
             DatosCompartidos* datos = (DatosCompartidos*)shmat(shmid, NULL, 0);
             if (datos == (void*)-1) 
@@ -421,6 +713,7 @@ void crear_hijos(int shmid, int semid, pid_t pids[])
                 case 1: validarFormulario(datos, semid); break;
                 case 2: encriptarFormulario(datos, semid); break;
                 case 3: clasificarFormulario(datos, semid); break;
+                case HIJO_DEDUPLICAR: deduplicarFormulario(datos, semid); break;
             }
 
             exit(0); // Por si la funcion llamada no termina el proceso
@@ -439,11 +732,71 @@ void crear_hijos(int shmid, int semid, pid_t pids[])
     }
 }
 
-int main() 
+int main(int argc, char* argv[]) 
 {
     int shmid;
     pid_t pids[NUM_HIJOS];
      
+    // Opciones:
+    //   -p auto | -p C0,C1,C2,C3[,C4]  fija cada hijo a un core: cargar, validar, encriptar, clasificar y
+    //                                  (opcional, con -d) deduplicar
+    //   -d first|last|flag            agrega la etapa de DNIs duplicados entre validar y encriptar
+    int opt;
+    int fijarHijos = 0;
+    int nCpus = 0; // Cores indicados explicitamente con -p
+    while ((opt = getopt(argc, argv, "p:d:")) != -1)
+    {
+        if (opt == 'p' && (strcmp(optarg, "auto") == 0 ||
+            (nCpus = sscanf(optarg, "%d,%d,%d,%d,%d", &cpus_hijos[0], &cpus_hijos[1], &cpus_hijos[2], &cpus_hijos[3], &cpus_hijos[4])) >= NUM_HIJOS - 1))
+            fijarHijos = 1;
+        else if (opt == 'd' && strcmp(optarg, "first") == 0)
+            politicaDedup = DEDUP_PRIMERO;
+        else if (opt == 'd' && strcmp(optarg, "last") == 0)
+            politicaDedup = DEDUP_ULTIMO;
+        else if (opt == 'd' && strcmp(optarg, "flag") == 0)
+            politicaDedup = DEDUP_MARCAR;
+        else
+        {
+            fprintf(stderr, "Uso: %s [-p auto|C0,C1,C2,C3[,C4]] [-d first|last|flag]\n", argv[0]);
+            fprintf(stderr, "  -p C0,..,C3  cores de cargar, validar, encriptar y clasificar; C4 (con -d), el de deduplicar\n");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < nCpus; i++)
+    {
+        if (!cpuValida(cpus_hijos[i]))
+        {
+            fprintf(stderr, "Core invalido: %d (no esta en linea o no esta permitido)\n", cpus_hijos[i]);
+            fprintf(stderr, "Uso: %s [-p auto|C0,C1,C2,C3[,C4]] [-d first|last|flag]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (fijarHijos)
+    {
+        // Se planifica en orden de pipeline para que cada hijo quede cerca del anterior
+        int orden[NUM_HIJOS] = {0, 1, HIJO_DEDUPLICAR, 2, 3};
+        int n = 0;
+        int plan[NUM_HIJOS];
+        for (int i = 0; i < NUM_HIJOS; i++)
+        {
+            if (orden[i] == HIJO_DEDUPLICAR && politicaDedup == DEDUP_NO)
+                continue;
+            orden[n] = orden[i];
+            plan[n++] = cpus_hijos[orden[i]];
+        }
+        planificarCpus(plan, n);
+        for (int i = 0; i < n; i++)
+            cpus_hijos[orden[i]] = plan[i];
+
+        printf("Hijos fijados a cores: cargar=%d validar=%d encriptar=%d clasificar=%d",
+               cpus_hijos[0], cpus_hijos[1], cpus_hijos[2], cpus_hijos[3]);
+        if (politicaDedup != DEDUP_NO)
+            printf(" deduplicar=%d", cpus_hijos[HIJO_DEDUPLICAR]);
+        printf("\n");
+        fflush(stdout); // Para que los hijos no hereden el mensaje en el buffer
+    }
     
     // Inicializar memoria compartida
     datos = inicializar_memoria_compartida(&shmid);
@@ -477,6 +830,8 @@ int main()
     // Esperar que hijos terminen
     for (int i = 0; i < NUM_HIJOS; i++) 
     {
+        if (pids[i] == -1)
+            continue;
         waitpid(pids[i], NULL, 0);
         switch(i) 
         {
@@ -484,6 +839,7 @@ int main()
             case 1: printf("Validador (PID %d) finalizó.\n", pids[i]); break;
             case 2: printf("Encriptador (PID %d) finalizó.\n", pids[i]); break;
             case 3: printf("Clasificador (PID %d) finalizó.\n", pids[i]); break;
+            case HIJO_DEDUPLICAR: printf("Deduplicador (PID %d) finalizó.\n", pids[i]); break;
         }
     }
 
@@ -493,6 +849,11 @@ int main()
     int reclamos=0, pedidos=0, consultas=0, otros=0, total=0;
     for (int i = 0; i < datos->cantidad; i++) 
     {
+        if (datos->formularios[i].descartado) // Rechazado por validar o descartado por deduplicar
+            continue;
+        if (!esVigente(datos, &datos->formularios[i])) // Reemplazado por otro con el mismo DNI (-d last)
+            continue;
+        total++;
         if (strcmp(datos->formularios[i].tipoForm, "Reclamo") == 0)
             reclamos++;
         else if (strcmp(datos->formularios[i].tipoForm, "Pedido") == 0)
@@ -502,7 +863,6 @@ int main()
         else
             otros++;
     }
-    total = datos->cantidad;
 
     datos->cantidadReclamos = reclamos;
     datos->cantidadPedidos = pedidos;
@@ -516,6 +876,11 @@ int main()
     printf("Pedidos: %d\n", datos->cantidadPedidos);
     printf("Consultas: %d\n", datos->cantidadConsultas);
     printf("Otros: %d\n", datos->cantidadOtros);
+    printf("Rechazados: %d\n", datos->cantidadRechazados);
+    if (datos->rechazadosPerdidos > 0)
+        printf("Rechazados sin guardar (arreglo lleno): %d\n", datos->rechazadosPerdidos);
+    if (politicaDedup != DEDUP_NO)
+        printf("DNIs duplicados: %d\n", datos->cantidadDuplicados);
 
     //Puesto unicamente con la intencion de revisar el resultado final de los formularios procesados
     //para asi verificar que todo funcione correctamente.
@@ -527,8 +892,11 @@ int main()
         for (int i = 0; i < datos->cantidad; i++)
         {
             Formulario* f = &datos->formularios[i];
-            fprintf(salida, "%-3d %-10ld %-15s %-15s %-12s %-12s %-10s %s\n",
-            f->id, f->dni, f->nombre, f->apellido, f->fechaNac, f->nroTelefono, f->tipoForm, f->descripcion);
+            if (f->descartado || !esVigente(datos, f))
+                continue;
+            fprintf(salida, "%-3d %-10ld %-15s %-15s %-12s %-12s %-10s %s%s\n",
+            f->id, f->dni, f->nombre, f->apellido, f->fechaNac, f->nroTelefono, f->tipoForm, f->descripcion,
+            f->duplicado ? " [DUPLICADO]" : "");
         }
         fclose(salida);
         printf("Datos procesados guardados en procesados.txt\n");
@@ -536,6 +904,31 @@ int main()
     else 
         printf("No se pudo abrir procesados.txt para escritura.\n");
 
+    //Los rechazados se guardan en el mismo formato que formularios.txt (con un comentario previo que indica
+    //los motivos) para poder corregirlos y volver a procesarlos.
+    FILE* rechazados = fopen("rechazados.txt", "w");
+    if (rechazados)
+    {
+        for (int i = 0; i < datos->cantidadRechazados; i++)
+        {
+            Formulario* f = &datos->rechazados[i];
+            fprintf(rechazados, "# id=%d motivos=0x%02x%s%s%s%s%s%s%s\n", f->id, f->motivos,
+                    (f->motivos & MOTIVO_ID) ? " id" : "",
+                    (f->motivos & MOTIVO_DNI) ? " dni" : "",
+                    (f->motivos & MOTIVO_NOMBRE) ? " nombre" : "",
+                    (f->motivos & MOTIVO_APELLIDO) ? " apellido" : "",
+                    (f->motivos & MOTIVO_FECHA) ? " fechaNac" : "",
+                    (f->motivos & MOTIVO_TELEFONO) ? " telefono" : "",
+                    (f->motivos & MOTIVO_DESCRIPCION) ? " descripcion" : "");
+            fprintf(rechazados, "%ld %s %s %s %s %s\n",
+                    f->dni, f->nombre, f->apellido, f->fechaNac, f->nroTelefono, f->descripcion);
+        }
+        fclose(rechazados);
+        printf("Formularios rechazados guardados en rechazados.txt\n");
+    }
+    else
+        printf("No se pudo abrir rechazados.txt para escritura.\n");
+
 
     // Liberar recursos
     liberar_semaforos(semid);